@@ -0,0 +1,13 @@
+###############################################################################
+# Project file for the sound engine benchmark (Tools/Benchmark.cpp)
+#
+# Times how fast the string and Tone Matrix code produce samples and prints
+# the results as CSV or JSON. Built separately from Tone Matrix.pro, which
+# skips the Tools folder.
+###############################################################################
+
+TARGET      =   Benchmark
+
+include(Tools/Tool.pri)
+
+SOURCES     +=  Tools/Benchmark.cpp
@@ -0,0 +1,179 @@
+/* File: AudioBuffering.cpp
+ *
+ * Storage for AudioSystem's buffering and render thread settings, and for its
+ * glitch counters. Like the sample rate in SampleRate.cpp, all of it lives in
+ * atomics, so the audio thread can read the settings and bump the counters
+ * without locking, and programs without a sound card can link it without the
+ * rest of AudioSystem.
+ */
+#include "AudioBuffering.h"
+#include "AudioMetrics.h"
+#include "AudioSystem.h"
+#include "error.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+using namespace std;
+
+namespace {
+    atomic<int>     theBufferFrames{0};
+    atomic<int>     thePeriodFrames{AudioSystem::kMaxPeriodFrames};
+    atomic<double>  theTargetLatency{0};
+    atomic<int64_t> theUnderruns{0};
+    atomic<int64_t> theOverruns{0};
+    atomic<int>     theRenderPriority{0};
+    atomic<int>     theRenderCore{-1};
+}
+
+void AudioSystem::setBufferFrames(int frames) {
+    if (frames < 0) {
+        error("Buffer size can't be negative.");
+    }
+    theBufferFrames.store(frames, memory_order_relaxed);
+}
+
+int AudioSystem::bufferFrames() {
+    return theBufferFrames.load(memory_order_relaxed);
+}
+
+void AudioSystem::setPeriodFrames(int frames) {
+    if (frames < 1 || frames > kMaxPeriodFrames) {
+        error("Period must be between 1 and " + to_string(kMaxPeriodFrames) + " samples.");
+    }
+    thePeriodFrames.store(frames, memory_order_relaxed);
+}
+
+int AudioSystem::periodFrames() {
+    return thePeriodFrames.load(memory_order_relaxed);
+}
+
+void AudioSystem::setTargetLatency(double seconds) {
+    if (!(seconds >= 0)) {
+        error("Target latency can't be negative.");
+    }
+    theTargetLatency.store(seconds, memory_order_relaxed);
+}
+
+double AudioSystem::targetLatency() {
+    return theTargetLatency.load(memory_order_relaxed);
+}
+
+int64_t AudioSystem::underruns() {
+    return theUnderruns.load(memory_order_relaxed);
+}
+
+int64_t AudioSystem::overruns() {
+    return theOverruns.load(memory_order_relaxed);
+}
+
+void AudioSystem::setRenderPriority(int priority) {
+    if (priority < 0) {
+        error("Render thread priority can't be negative.");
+    }
+    theRenderPriority.store(priority, memory_order_relaxed);
+}
+
+int AudioSystem::renderPriority() {
+    return theRenderPriority.load(memory_order_relaxed);
+}
+
+void AudioSystem::setRenderCore(int core) {
+    if (core < -1) {
+        error("Render thread core must be -1 (any core) or a core number.");
+    }
+    theRenderCore.store(core, memory_order_relaxed);
+}
+
+int AudioSystem::renderCore() {
+    return theRenderCore.load(memory_order_relaxed);
+}
+
+namespace AudioBuffering {
+    void noteUnderrun() {
+        theUnderruns.fetch_add(1, memory_order_relaxed);
+    }
+
+    void noteCallback(int frames, double seconds) {
+        AudioMetrics::recordCallback(frames, seconds);
+        if (seconds * AudioSystem::sampleRate() > frames) {
+            theOverruns.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    /* Grows by half again each time, so a machine that needs a much bigger
+     * buffer gets there after a few glitches rather than dozens.
+     */
+    int grownBufferFrames(int currentFrames) {
+        double target = AudioSystem::targetLatency();
+        if (target <= 0) return currentFrames;
+
+        int limit = int(floor(target * AudioSystem::sampleRate()));
+        int grown = currentFrames + max(currentFrames / 2, AudioSystem::periodFrames());
+        return max(currentFrames, min(grown, limit));
+    }
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include "GUI/SimpleTest.h"
+
+STUDENT_TEST("Buffering settings are checked and remembered.") {
+    int oldBuffer = AudioSystem::bufferFrames();
+    int oldPeriod = AudioSystem::periodFrames();
+
+    AudioSystem::setBufferFrames(1024);
+    AudioSystem::setPeriodFrames(256);
+    EXPECT_EQUAL(AudioSystem::bufferFrames(), 1024);
+    EXPECT_EQUAL(AudioSystem::periodFrames(), 256);
+
+    EXPECT_ERROR(AudioSystem::setBufferFrames(-1));
+    EXPECT_ERROR(AudioSystem::setPeriodFrames(0));
+    EXPECT_ERROR(AudioSystem::setPeriodFrames(AudioSystem::kMaxPeriodFrames + 1));
+    EXPECT_ERROR(AudioSystem::setTargetLatency(-0.1));
+    EXPECT_EQUAL(AudioSystem::bufferFrames(), 1024);
+    EXPECT_EQUAL(AudioSystem::periodFrames(), 256);
+
+    AudioSystem::setBufferFrames(oldBuffer);
+    AudioSystem::setPeriodFrames(oldPeriod);
+}
+
+STUDENT_TEST("Underruns grow the buffer up to the target latency, and no further.") {
+    AudioSystem::setSampleRate(44100);
+    int oldPeriod = AudioSystem::periodFrames();
+    double oldTarget = AudioSystem::targetLatency();
+    AudioSystem::setPeriodFrames(256);
+
+    /* With no target, the buffer stays put. */
+    AudioSystem::setTargetLatency(0);
+    EXPECT_EQUAL(AudioBuffering::grownBufferFrames(1024), 1024);
+
+    /* With one, it grows by half each time until it hits the target. */
+    AudioSystem::setTargetLatency(0.05);
+    EXPECT_EQUAL(AudioBuffering::grownBufferFrames(1024), 1536);
+    EXPECT_EQUAL(AudioBuffering::grownBufferFrames(1536), 2205);
+    EXPECT_EQUAL(AudioBuffering::grownBufferFrames(2205), 2205);
+
+    /* Small buffers grow by at least a period. */
+    EXPECT_EQUAL(AudioBuffering::grownBufferFrames(0), 256);
+
+    /* A buffer already past the target isn't shrunk. */
+    EXPECT_EQUAL(AudioBuffering::grownBufferFrames(4096), 4096);
+
+    AudioSystem::setPeriodFrames(oldPeriod);
+    AudioSystem::setTargetLatency(oldTarget);
+}
+
+STUDENT_TEST("Only callbacks slower than real time count as overruns.") {
+    AudioSystem::setSampleRate(44100);
+
+    int64_t before = AudioSystem::overruns();
+    AudioBuffering::noteCallback(441, 0.009);
+    EXPECT_EQUAL(AudioSystem::overruns(), before);
+    AudioBuffering::noteCallback(441, 0.011);
+    EXPECT_EQUAL(AudioSystem::overruns(), before + 1);
+
+    before = AudioSystem::underruns();
+    AudioBuffering::noteUnderrun();
+    EXPECT_EQUAL(AudioSystem::underruns(), before + 1);
+}
@@ -0,0 +1,26 @@
+/* File: AudioBuffering.h
+ *
+ * Bookkeeping behind AudioSystem's buffering settings and glitch counters.
+ * The settings themselves are read and written through AudioSystem; this is
+ * the part the audio backend uses to report what happened and to decide how
+ * to react to it. None of it needs a sound card.
+ */
+#pragma once
+
+namespace AudioBuffering {
+    /* Records that the sound card ran dry and had to be restarted. */
+    void noteUnderrun();
+
+    /* Records that an audio callback took the given number of seconds to
+     * produce the given number of samples. If that's longer than the samples
+     * take to play, it counts as an overrun. Either way, it's recorded in
+     * AudioMetrics.
+     */
+    void noteCallback(int frames, double seconds);
+
+    /* If AudioSystem has a target latency set, returns a bigger buffer size
+     * to use after an underrun with a buffer of the given size, without going
+     * past the target. Otherwise returns the current size unchanged.
+     */
+    int grownBufferFrames(int currentFrames);
+}
@@ -0,0 +1,252 @@
+/* File: AudioMetrics.cpp
+ *
+ * Implementation of the AudioMetrics functions.
+ *
+ * Each histogram has a fixed set of buckets spaced out geometrically, so
+ * recording a value is a logarithm and an atomic increment. Percentiles are
+ * read off the bucket counts by whoever asks for them.
+ */
+#include "AudioMetrics.h"
+#include "AudioSystem.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+using namespace std;
+
+namespace {
+    /* Geometric histogram over [lowest, highest). The first bucket holds
+     * everything below lowest and the last everything from highest up.
+     */
+    class Histogram {
+    public:
+        Histogram(double lowest, double highest)
+            : _lowest(lowest), _logStep(log(highest / lowest) / (kBuckets - 2)) {
+            reset();
+        }
+
+        void record(double value) {
+            _counts[bucketFor(value)].fetch_add(1, memory_order_relaxed);
+
+            double seen = _max.load(memory_order_relaxed);
+            while (value > seen && !_max.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+                // seen has been reloaded; try again.
+            }
+        }
+
+        void reset() {
+            for (auto& count: _counts) {
+                count.store(0, memory_order_relaxed);
+            }
+            _max.store(0, memory_order_relaxed);
+        }
+
+        AudioMetrics::Summary summary() const {
+            int64_t counts[kBuckets];
+            int64_t total = 0;
+            for (int i = 0; i < kBuckets; i++) {
+                counts[i] = _counts[i].load(memory_order_relaxed);
+                total += counts[i];
+            }
+
+            double max = _max.load(memory_order_relaxed);
+            return { total, percentile(counts, total, 0.50, max), percentile(counts, total, 0.99, max), max };
+        }
+
+    private:
+        static const int kBuckets = 64;
+
+        double _lowest;
+        double _logStep;
+        atomic<int64_t> _counts[kBuckets];
+        atomic<double> _max;
+
+        int bucketFor(double value) const {
+            if (!(value >= _lowest)) return 0;
+            int bucket = 1 + int(log(value / _lowest) / _logStep);
+            return min(bucket, kBuckets - 1);
+        }
+
+        /* Top edge of a bucket, which is the value a percentile landing in
+         * it is reported as.
+         */
+        double upperEdge(int bucket) const {
+            return _lowest * exp(_logStep * bucket);
+        }
+
+        /* The value below which the given fraction of samples fall, rounded
+         * up to the top of its bucket but never past the largest value seen.
+         */
+        double percentile(const int64_t counts[], int64_t total, double fraction, double max) const {
+            if (total == 0) return 0;
+
+            int64_t rank = int64_t(ceil(fraction * total));
+            int64_t seen = 0;
+            for (int i = 0; i < kBuckets; i++) {
+                seen += counts[i];
+                if (seen >= rank) return std::min(upperEdge(i), max);
+            }
+            return max;
+        }
+    };
+
+    /* One microsecond to one second per callback, and a thousandth of a
+     * deadline to a hundred deadlines.
+     */
+    Histogram theRenderSeconds(1e-6, 1.0);
+    Histogram theDeadlineUse(1e-3, 100.0);
+
+    atomic<int64_t> theFramesRequested{0};
+    atomic<int64_t> theFramesDelivered{0};
+    atomic<int64_t> theIdleRestarts{0};
+    atomic<int>     theVoices{0};
+    atomic<int>     thePeakVoices{0};
+
+    /* Formats a number of seconds as milliseconds. */
+    string millis(double seconds) {
+        ostringstream result;
+        result << fixed << setprecision(3) << seconds * 1000 << "ms";
+        return result.str();
+    }
+
+    /* Formats how much of a deadline is left as a percentage. */
+    string headroom(double use) {
+        ostringstream result;
+        result << fixed << setprecision(0) << (1 - use) * 100 << "%";
+        return result.str();
+    }
+}
+
+namespace AudioMetrics {
+    void recordCallback(int frames, double seconds) {
+        theRenderSeconds.record(seconds);
+        if (frames > 0) {
+            theDeadlineUse.record(seconds * AudioSystem::sampleRate() / frames);
+        }
+    }
+
+    void recordDelivery(int64_t requested, int64_t delivered) {
+        theFramesRequested.fetch_add(requested, memory_order_relaxed);
+        theFramesDelivered.fetch_add(delivered, memory_order_relaxed);
+    }
+
+    void recordIdleRestart() {
+        theIdleRestarts.fetch_add(1, memory_order_relaxed);
+    }
+
+    void recordVoices(int voices) {
+        theVoices.store(voices, memory_order_relaxed);
+
+        int peak = thePeakVoices.load(memory_order_relaxed);
+        while (voices > peak && !thePeakVoices.compare_exchange_weak(peak, voices, memory_order_relaxed)) {
+            // peak has been reloaded; try again.
+        }
+    }
+
+    Snapshot snapshot() {
+        Snapshot result;
+        result.renderSeconds   = theRenderSeconds.summary();
+        result.deadlineUse     = theDeadlineUse.summary();
+        result.framesRequested = theFramesRequested.load(memory_order_relaxed);
+        result.framesDelivered = theFramesDelivered.load(memory_order_relaxed);
+        result.idleRestarts    = theIdleRestarts.load(memory_order_relaxed);
+        result.underruns       = AudioSystem::underruns();
+        result.overruns        = AudioSystem::overruns();
+        result.voices          = theVoices.load(memory_order_relaxed);
+        result.peakVoices      = thePeakVoices.load(memory_order_relaxed);
+        return result;
+    }
+
+    void reset() {
+        theRenderSeconds.reset();
+        theDeadlineUse.reset();
+        theFramesRequested.store(0, memory_order_relaxed);
+        theFramesDelivered.store(0, memory_order_relaxed);
+        theIdleRestarts.store(0, memory_order_relaxed);
+        theVoices.store(0, memory_order_relaxed);
+        thePeakVoices.store(0, memory_order_relaxed);
+    }
+
+    /* Headroom is reported the other way around from deadline use: the p99
+     * headroom is what 99% of callbacks had at least, and the worst is what
+     * the slowest callback had.
+     */
+    string report(const Snapshot& snapshot) {
+        ostringstream result;
+        result << "Render:   p50 " << millis(snapshot.renderSeconds.p50)
+               << "   p99 " << millis(snapshot.renderSeconds.p99)
+               << "   max " << millis(snapshot.renderSeconds.max)
+               << "   (" << snapshot.renderSeconds.count << " callbacks)" << '\n';
+        result << "Headroom: p50 " << headroom(snapshot.deadlineUse.p50)
+               << "   p99 " << headroom(snapshot.deadlineUse.p99)
+               << "   worst " << headroom(snapshot.deadlineUse.max) << '\n';
+        result << "Frames:   " << snapshot.framesDelivered << " delivered of "
+               << snapshot.framesRequested << " requested" << '\n';
+        result << "Xruns:    " << snapshot.underruns << " underruns ("
+               << snapshot.idleRestarts << " sink restarts), "
+               << snapshot.overruns << " overruns" << '\n';
+        result << "Voices:   " << snapshot.voices << " now, "
+               << snapshot.peakVoices << " peak";
+        return result.str();
+    }
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include "GUI/SimpleTest.h"
+
+STUDENT_TEST("Histogram percentiles land within a bucket of the truth.") {
+    Histogram histogram(1e-6, 1.0);
+
+    /* 98 fast callbacks, and two slow ones. */
+    for (int i = 0; i < 98; i++) {
+        histogram.record(100e-6);
+    }
+    histogram.record(5e-3);
+    histogram.record(20e-3);
+
+    AudioMetrics::Summary summary = histogram.summary();
+    EXPECT_EQUAL(summary.count, 100);
+    EXPECT(summary.p50 >= 100e-6 && summary.p50 < 130e-6);
+    EXPECT(summary.p99 >= 5e-3 && summary.p99 < 6.5e-3);
+    EXPECT_EQUAL(summary.max, 20e-3);
+
+    /* Out-of-range values still count. */
+    histogram.record(0);
+    histogram.record(50.0);
+    EXPECT_EQUAL(histogram.summary().count, 102);
+    EXPECT_EQUAL(histogram.summary().max, 50.0);
+
+    histogram.reset();
+    EXPECT_EQUAL(histogram.summary().count, 0);
+    EXPECT_EQUAL(histogram.summary().p99, 0);
+}
+
+STUDENT_TEST("AudioMetrics measures callbacks against their deadlines.") {
+    AudioSystem::setSampleRate(44100);
+    AudioMetrics::reset();
+
+    /* 441 samples play for 10ms, so 5ms is half the deadline. */
+    AudioMetrics::recordCallback(441, 0.005);
+    AudioMetrics::recordDelivery(512, 441);
+    AudioMetrics::recordIdleRestart();
+    AudioMetrics::recordVoices(30);
+    AudioMetrics::recordVoices(12);
+
+    AudioMetrics::Snapshot snapshot = AudioMetrics::snapshot();
+    EXPECT_EQUAL(snapshot.renderSeconds.count, 1);
+    EXPECT(fabs(snapshot.deadlineUse.max - 0.5) < 1e-9);
+    EXPECT_EQUAL(snapshot.framesRequested, 512);
+    EXPECT_EQUAL(snapshot.framesDelivered, 441);
+    EXPECT_EQUAL(snapshot.idleRestarts, 1);
+    EXPECT_EQUAL(snapshot.voices, 12);
+    EXPECT_EQUAL(snapshot.peakVoices, 30);
+
+    string report = AudioMetrics::report(snapshot);
+    EXPECT(report.find("441 delivered of 512 requested") != string::npos);
+    EXPECT(report.find("worst 50%") != string::npos);
+
+    AudioMetrics::reset();
+    EXPECT_EQUAL(AudioMetrics::snapshot().renderSeconds.count, 0);
+}
@@ -0,0 +1,68 @@
+/* File: AudioMetrics.h
+ *
+ * Measurements of how the audio engine is keeping up: how long each audio
+ * callback takes, how much of its deadline that uses, how many samples the
+ * sound card asked for versus got, and how often things went wrong.
+ *
+ * Everything is recorded into fixed-size histograms and counters made of
+ * atomics, so the audio thread can record without ever locking or
+ * allocating memory. Any thread can take a snapshot at any time; a snapshot
+ * taken while the audio thread is recording may be a sample or two out of
+ * step between its fields, but each field is sound on its own.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace AudioMetrics {
+    /* Records that an audio callback took the given number of seconds to
+     * produce the given number of samples. The callback's deadline is how
+     * long those samples take to play.
+     */
+    void recordCallback(int frames, double seconds);
+
+    /* Records that the sound card asked for requested samples, of which
+     * delivered were real audio rather than silence or nothing.
+     */
+    void recordDelivery(int64_t requested, int64_t delivered);
+
+    /* Records that the sound card went idle and had to be restarted. */
+    void recordIdleRestart();
+
+    /* Records how many strings are currently making sound. */
+    void recordVoices(int voices);
+
+    /* A histogram boiled down. Percentiles are accurate to within the width
+     * of a bucket, about a fifth of their value.
+     */
+    struct Summary {
+        int64_t count;
+        double p50;
+        double p99;
+        double max;
+    };
+
+    struct Snapshot {
+        Summary renderSeconds;      // Time taken by each callback
+        Summary deadlineUse;        // Fraction of its deadline each callback used
+        int64_t framesRequested;
+        int64_t framesDelivered;
+        int64_t idleRestarts;
+        int64_t underruns;          // From AudioSystem::underruns()
+        int64_t overruns;           // From AudioSystem::overruns()
+        int voices;                 // Most recently recorded voice count
+        int peakVoices;
+    };
+
+    /* Everything recorded since the last reset(). */
+    Snapshot snapshot();
+
+    /* Clears the histograms and counters, except for AudioSystem's own. */
+    void reset();
+
+    /* A few lines of human-readable text describing the snapshot, separated
+     * by newlines.
+     */
+    std::string report(const Snapshot& snapshot);
+}
@@ -7,15 +7,35 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include "AudioSystem.h"
+#include "AudioBuffering.h"
+#include "AudioMetrics.h"
+#include "RenderThread.h"
+#include "Resampler.h"
 #include "error.h"
 #include "gthread.h"
 #include "gwindow.h"
 using namespace std;
 
 namespace {
-    /* Number of sound samples to buffer. */
-    const qint64 kInternalBufferSize = 4000;
+    /* Number of sound samples to buffer; enough for the longest period. */
+    const qint64 kInternalBufferSize = AudioSystem::kMaxPeriodFrames;
+
+    /* Whether a ring underrun is already waiting for the GUI thread to grow
+     * the buffer, so that a long run of them only asks once.
+     */
+    atomic<bool> theGrowQueued{false};
+
+    /* Runs the callback, letting AudioBuffering know how long it took. */
+    template <typename Callback, typename T> void timedCall(const Callback& callback, T* buffer, int count) {
+        auto start = chrono::steady_clock::now();
+        callback(buffer, count);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        AudioBuffering::noteCallback(count, elapsed.count());
+    }
 
     /* Adapter from a callback function to a QIODevice. */
     class AudioAdapter: public QIODevice {
@@ -25,6 +45,17 @@ namespace {
 
         }
 
+        /* Take ownership of a render thread to copy samples from. Underruns
+         * are reported to owner.
+         */
+        AudioAdapter(RenderThread* renderer, AudioSystem* owner) : renderer(renderer), owner(owner) {
+
+        }
+
+        ~AudioAdapter() {
+            delete renderer;
+        }
+
         bool isSequential() const override {
             return false;
         }
@@ -40,9 +71,14 @@ namespace {
             /* Convert from bytes to floats. */
             maxSize /= sizeof(float);
 
+            if (renderer != nullptr) {
+                return readRing(data, maxSize) * sizeof(float);
+            }
+
             /* See how many we can actually read, then do the read. */
-            qint64 toRead = min(maxSize, kInternalBufferSize);
-            callback(callbackBuffer, toRead);
+            qint64 toRead = min<qint64>(maxSize, AudioSystem::periodFrames());
+            timedCall(callback, callbackBuffer, toRead);
+            AudioMetrics::recordDelivery(maxSize, toRead);
 
             /* Convert format. */
             for (int i = 0; i < toRead; i++) {
@@ -60,32 +96,49 @@ namespace {
         }
 
     private:
-        AudioCallback callback;
-        double        callbackBuffer[kInternalBufferSize];
-        float         dataBuffer[kInternalBufferSize];
-    };
+        AudioCallback      callback;
+        RenderThread*      renderer = nullptr;
+        AudioSystem*       owner = nullptr;
+        double             callbackBuffer[kInternalBufferSize];
+        float              dataBuffer[kInternalBufferSize];
+
+        /* Copies whatever the render thread has ready straight into Qt's
+         * buffer. Qt's buffers are always suitably aligned in practice, but
+         * if one ever isn't, we go through dataBuffer. If the render thread
+         * has nothing at all, we send a period of silence rather than
+         * nothing, which would stop the sink, and count it as an underrun.
+         * Since the sink never goes idle, it's up to us to ask for a bigger
+         * buffer.
+         */
+        qint64 readRing(char* data, qint64 count) {
+            count = min<qint64>(count, numeric_limits<int>::max());
+
+            qint64 result;
+            if (reinterpret_cast<uintptr_t>(data) % alignof(float) == 0) {
+                result = renderer->read(reinterpret_cast<float*>(data), int(count));
+            } else {
+                result = renderer->read(dataBuffer, int(min(count, kInternalBufferSize)));
+                memcpy(data, dataBuffer, result * sizeof(float));
+            }
+            AudioMetrics::recordDelivery(count, result);
 
-    /* Global sample rate. */
-    int theSampleRate = 44100;
-}
+            if (result == 0 && count > 0) {
+                AudioBuffering::noteUnderrun();
+                result = min<qint64>(count, AudioSystem::periodFrames());
+                memset(data, 0, result * sizeof(float));
 
-int AudioSystem::sampleRate() {
-    int result;
-    GThread::runOnQtGuiThread([&] {
-        result = theSampleRate;
-    });
-    return result;
+                if (!theGrowQueued.exchange(true)) {
+                    QMetaObject::invokeMethod(owner, &AudioSystem::handleRingUnderrun, Qt::QueuedConnection);
+                }
+            }
+            return result;
+        }
+    };
 }
 
-void AudioSystem::setSampleRate(int rate) {
-    if (rate <= 0) {
-        error("Sample rate must be positive.");
-    }
-
-    GThread::runOnQtGuiThread([&] {
-        theSampleRate = rate;
-    });
-}
+/* sampleRate() and setSampleRate() live in SampleRate.cpp so that programs
+ * without a sound card can use them without linking all of this.
+ */
 
 AudioSystem::AudioSystem() {
     /* Set the audio format. */
@@ -107,10 +160,45 @@ AudioSystem::AudioSystem() {
 void AudioSystem::play(AudioCallback callback) {
     GThread::runOnQtGuiThread([&] {
         instance()->state = State::PLAYING;
-        instance()->playImpl(callback);
+        instance()->playImpl(new AudioAdapter(callback));
+    });
+}
+
+void AudioSystem::playFloat(FloatAudioCallback callback) {
+    /* Synthesis happens on the render thread, so the GUI thread only ever
+     * copies finished samples to the sound card.
+     */
+    auto* renderer = new RenderThread(callback, 2 * periodFrames(), periodFrames());
+    if (renderPriority() > 0) {
+        renderer->setPriority(renderPriority());
+    }
+    if (renderCore() >= 0) {
+        renderer->setCore(renderCore());
+    }
+
+    GThread::runOnQtGuiThread([&] {
+        instance()->state = State::PLAYING;
+        instance()->playImpl(new AudioAdapter(renderer, instance()));
     });
 }
 
+void AudioSystem::playFloat(FloatAudioCallback callback, int renderRate) {
+    if (renderRate <= 0) {
+        error("Render rate must be positive.");
+    }
+
+    /* The resampler pulls from the engine on the render thread, and the
+     * callback keeps it alive for as long as the render thread does.
+     */
+    if (renderRate != sampleRate()) {
+        auto resampler = make_shared<Resampler>(callback, renderRate, sampleRate());
+        callback = [resampler](float* out, int frames) {
+            resampler->render(out, frames);
+        };
+    }
+    playFloat(callback);
+}
+
 void AudioSystem::stop() {
     GThread::runOnQtGuiThread([&] {
         instance()->state = State::STOPPED;
@@ -127,19 +215,50 @@ void AudioSystem::handleStateChanged(QAudio::State newState) {
             stopImpl();
         }
 
-        /* Otherwise there should still be data generated. Restart. */
-        audio->start(device);
+        /* Otherwise there should still be data generated, and we ran dry.
+         * Restart, with a bigger buffer if we're allowed one.
+         */
+        else {
+            AudioBuffering::noteUnderrun();
+            AudioMetrics::recordIdleRestart();
+            if (!growBuffer()) {
+                audio->start(device);
+            }
+        }
+    }
+}
+
+/* The underrun itself was already counted when it happened. */
+void AudioSystem::handleRingUnderrun() {
+    theGrowQueued = false;
+    if (state == State::PLAYING && audio != nullptr) {
+        growBuffer();
     }
 }
 
-void AudioSystem::playImpl(AudioCallback callback) {
+/* Restarts the sink with a bigger buffer, if the target latency leaves room
+ * for one. Returns whether it did.
+ */
+bool AudioSystem::growBuffer() {
+    int current = audio->bufferSize() / sizeof(float);
+    int grown   = AudioBuffering::grownBufferFrames(current);
+    if (grown == current) return false;
+
+    setBufferFrames(grown);
+    audio->stop();
+    audio->setBufferSize(grown * sizeof(float));
+    audio->start(device);
+    return true;
+}
+
+void AudioSystem::playImpl(QIODevice* source) {
     if (!GThread::iAmRunningOnTheQtGuiThread()) {
         error("Internal threading error. Contact htiek@cs.stanford.edu to report a bug.");
     }
 
     /* Wire the buffer into an AudioAdapter wrapper. */
     //cout << "Making adapter." << endl;
-    device = new AudioAdapter(callback);
+    device = source;
     device->open(QIODevice::ReadOnly);
 
     /* Get an audio sink we can write to. */
@@ -150,6 +269,11 @@ void AudioSystem::playImpl(AudioCallback callback) {
     //cout << "Connecting us." << endl;
     connect(audio, &QAudioSink::stateChanged, this, &AudioSystem::handleStateChanged);
 
+    /* Size its buffer, if we've been asked to. */
+    if (bufferFrames() > 0) {
+        audio->setBufferSize(bufferFrames() * sizeof(float));
+    }
+
     /* Start sound transfer. */
     //cout << "Starting audio." << endl;
     audio->start(device);
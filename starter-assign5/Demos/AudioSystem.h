@@ -2,35 +2,108 @@
 
 #include <QObject>
 #include <QAudioSink>
+#include <cstdint>
 #include <functional>
 
 using AudioCallback = std::function<void (double*, int)>;
 
+/* A callback that writes float samples ready for the sound card. It's called
+ * on a render thread of its own, for periodFrames() samples at a time, and
+ * the samples it writes must already be in the range [-1, +1].
+ */
+using FloatAudioCallback = std::function<void (float*, int)>;
+
 class AudioSystem: public QObject {
     Q_OBJECT
 
 public:
     /* These can be called from anywhere. */
     static void play(AudioCallback callback);
+    static void playFloat(FloatAudioCallback callback);
+
+    /* Like playFloat(callback), for a callback that produces samples at the
+     * given rate rather than at sampleRate(). Its samples are converted to
+     * sampleRate() on the way to the sound card (see Resampler.h). This is
+     * for engines that synthesize at a rate of their own, such as a
+     * ToneMatrix given a render rate.
+     */
+    static void playFloat(FloatAudioCallback callback, int renderRate);
     static void stop();
 
     static int  sampleRate();
     static void setSampleRate(int sampleRate);
 
+    /* Every call to setSampleRate bumps this counter, so code that caches
+     * anything derived from the sample rate can tell when it's gone stale.
+     * The two-argument sampleRate reads the rate and its version together.
+     */
+    static unsigned sampleRateVersion();
+    static int      sampleRate(unsigned& version);
+
+    /* How much audio the sound card buffers, in samples. Smaller buffers
+     * mean less delay between a click and the sound it makes, but leave less
+     * slack before the sound card runs dry. Zero, the default, leaves the
+     * choice to the platform. A new size takes effect the next time the
+     * sound card is started.
+     */
+    static void setBufferFrames(int frames);
+    static int  bufferFrames();
+
+    /* The most samples an audio callback is asked for at once. Callbacks
+     * asked for less do less work at a time, so changes made between them
+     * are heard sooner. Must be between 1 and kMaxPeriodFrames.
+     */
+    static const int kMaxPeriodFrames = 4000;
+    static void setPeriodFrames(int frames);
+    static int  periodFrames();
+
+    /* If this is positive, every underrun makes the buffer bigger, up to this
+     * many seconds of audio, and bufferFrames() reports what it settled on.
+     * That goes for the sound card running dry under play() and for the
+     * render thread falling behind under playFloat(). Zero, the default,
+     * keeps the buffer at whatever size it was set to.
+     */
+    static void   setTargetLatency(double seconds);
+    static double targetLatency();
+
+    /* How many times the sound card has run out of audio and had to be
+     * restarted, and how many times an audio callback has taken longer to
+     * run than the audio it produced takes to play.
+     */
+    static int64_t underruns();
+    static int64_t overruns();
+
+    /* playFloat() runs its callback on a render thread that stays two
+     * periods ahead of the sound card. These set the real-time priority that
+     * thread asks for (zero, the default, means normal priority) and the core
+     * it's kept on (-1, the default, means any). Both are only honored on
+     * Linux, and take effect the next time playFloat() is called.
+     */
+    static void setRenderPriority(int priority);
+    static int  renderPriority();
+    static void setRenderCore(int core);
+    static int  renderCore();
+
     /* All of these can only be called on the Qt GUI thread. */
 
 
 public slots:
     void handleStateChanged(QAudio::State newState);
 
+    /* Called on the GUI thread after playFloat()'s render thread has fallen
+     * behind the sound card.
+     */
+    void handleRingUnderrun();
+
 private:
     AudioSystem();
     AudioSystem(const AudioSystem&) = delete;
     void operator= (AudioSystem) = delete;
 
     static AudioSystem* instance();
-    void playImpl(AudioCallback toPlay);
+    void playImpl(QIODevice* source);
     void stopImpl();
+    bool growBuffer();
 
     QAudioFormat  format;
     QAudioSink*   audio;
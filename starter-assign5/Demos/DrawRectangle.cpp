@@ -3,17 +3,72 @@
 using namespace std;
 
 namespace {
-    DrawFunction theDrawFunction;
+    DrawFunction      theDrawFunction;
+    BatchDrawFunction theBatchDrawFunction;
+
+    bool hasDrawFunction() {
+        return theDrawFunction || theBatchDrawFunction;
+    }
+
+    void checkDrawFunction() {
+        if (!hasDrawFunction()) {
+            error("drawRectangle() was called without a RectangleCatcher set up to catch the rectangles. Make sure to create a RectangleCatcher when testing the ToneMatrix::draw() function.");
+        }
+    }
 }
 
 void drawRectangle(const Rectangle& bounds, Color color) {
-    if (!theDrawFunction) {
-        error("drawRectangle() was called without a RectangleCatcher set up to catch the rectangles. Make sure to create a RectangleCatcher when testing the ToneMatrix::draw() function.");
+    checkDrawFunction();
+
+    if (theBatchDrawFunction) {
+        theBatchDrawFunction(&bounds, &color, 1);
+    } else {
+        theDrawFunction(bounds, color);
     }
+}
+
+void drawRectangles(const Rectangle* bounds, const Color* colors, int count) {
+    if (count <= 0) return;
+    checkDrawFunction();
 
-    theDrawFunction(bounds, color);
+    if (theBatchDrawFunction) {
+        theBatchDrawFunction(bounds, colors, count);
+    } else {
+        for (int i = 0; i < count; i++) {
+            theDrawFunction(bounds[i], colors[i]);
+        }
+    }
 }
 
 void setDrawFunction(DrawFunction fn) {
     theDrawFunction = fn;
+    theBatchDrawFunction = nullptr;
+}
+
+void setBatchDrawFunction(BatchDrawFunction fn) {
+    theBatchDrawFunction = fn;
+    theDrawFunction = nullptr;
+}
+
+/* Destructors can't report errors, so if there's nowhere to send the
+ * rectangles, quietly drop them. Calling flush() explicitly reports the error.
+ */
+RectangleBatch::~RectangleBatch() {
+    if (hasDrawFunction()) {
+        flush();
+    }
+}
+
+void RectangleBatch::add(const Rectangle& rectangle, Color color) {
+    if (count == kCapacity) flush();
+
+    bounds[count] = rectangle;
+    colors[count] = color;
+    count++;
+}
+
+void RectangleBatch::flush() {
+    int toDraw = count;
+    count = 0;
+    drawRectangles(bounds, colors, toDraw);
 }
@@ -8,5 +8,39 @@ using MiniGUI::Color;
 
 using DrawFunction = std::function<void(const Rectangle&, Color)>;
 
+/* Receives a whole run of rectangles at once: bounds[i] is drawn in
+ * colors[i], for each i from 0 up to count.
+ */
+using BatchDrawFunction = std::function<void(const Rectangle* bounds, const Color* colors, int count)>;
+
 void drawRectangle(const Rectangle& bounds, Color color);
+void drawRectangles(const Rectangle* bounds, const Color* colors, int count);
+
+/* Only one draw function is active at a time; setting either kind replaces
+ * whatever was there before. Rectangles are forwarded to whichever kind is
+ * set, singly or in batches as needed.
+ */
 void setDrawFunction(DrawFunction fn);
+void setBatchDrawFunction(BatchDrawFunction fn);
+
+/* Collects rectangles and passes them along in batches, without allocating
+ * any memory. Call flush() when done; anything still buffered is also drawn
+ * when the batch goes away.
+ */
+class RectangleBatch {
+public:
+    RectangleBatch() = default;
+    ~RectangleBatch();
+
+    void add(const Rectangle& bounds, Color color);
+    void flush();
+
+    RectangleBatch(const RectangleBatch&) = delete;
+    void operator= (const RectangleBatch&) = delete;
+
+private:
+    static const int kCapacity = 64;
+    Rectangle bounds[kCapacity];
+    Color     colors[kCapacity];
+    int       count = 0;
+};
@@ -8,6 +8,7 @@
 #include "gtimer.h"
 #include "gthread.h"
 #include <fstream>
+#include <algorithm>
 using namespace std;
 using namespace MiniGUI;
 
@@ -68,12 +69,13 @@ namespace {
 
             /* Connect to the audio system. */
             AudioSystem::play([&](double* buffer, int toRead) {
-                for (int i = 0; i < toRead; i++) {
-                    Sample result = 0.0;
-                    for (int j = 0; j < keys.size(); j++) {
-                        result += keys[j]->instrument.nextSample();
-                    }
-                    buffer[i] = result;
+                if (keys.isEmpty()) {
+                    fill(buffer, buffer + toRead, 0.0);
+                }
+
+                /* Let each string fill in the whole buffer, mixing into what's there. */
+                for (int j = 0; j < keys.size(); j++) {
+                    keys[j]->instrument.render(buffer, toRead, j > 0);
                 }
             });
         }
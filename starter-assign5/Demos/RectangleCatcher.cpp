@@ -8,14 +8,16 @@
 using namespace std;
 
 RectangleCatcher::RectangleCatcher() {
-    /* Stash what's drawn here. */
-    setDrawFunction([this] (const Rectangle& rect, Color c) {
-        drawn.add({ rect, c });
+    /* Stash what's drawn here, whether it arrives one at a time or in bulk. */
+    setBatchDrawFunction([this] (const Rectangle* rects, const Color* colors, int count) {
+        for (int i = 0; i < count; i++) {
+            drawn.add({ rects[i], colors[i] });
+        }
     });
 }
 
 RectangleCatcher::~RectangleCatcher() {
-    setDrawFunction(nullptr);
+    setBatchDrawFunction(nullptr);
 }
 
 int RectangleCatcher::numDrawn() const {
@@ -0,0 +1,178 @@
+/* File: RenderThread.cpp
+ *
+ * Implementation of the RenderThread type.
+ *
+ * The render thread renders a period at a time whenever there's room for one
+ * more below the target, then sleeps. Each read() nudges it awake, and it
+ * also wakes up on its own every so often in case it missed a nudge, so a
+ * lost wakeup costs at most a millisecond of slack rather than a glitch.
+ */
+#include "RenderThread.h"
+#include "AudioBuffering.h"
+#include "error.h"
+#include <algorithm>
+#include <chrono>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+using namespace std;
+
+namespace {
+    const chrono::milliseconds kIdleWait(1);
+}
+
+RenderThread::RenderThread(FloatAudioCallback callback, int aheadFrames, int periodFrames)
+    : _callback(callback), _ring(max(aheadFrames, 1)) {
+    if (periodFrames <= 0 || aheadFrames < periodFrames) {
+        error("Render thread must buffer at least one period ahead.");
+    }
+    _aheadFrames  = aheadFrames;
+    _periodFrames = periodFrames;
+    _block = new float[periodFrames];
+
+    _thread = thread(&RenderThread::run, this);
+}
+
+RenderThread::~RenderThread() {
+    _stopping.store(true);
+    {
+        /* Taking the lock here makes sure the thread isn't between checking
+         * _stopping and going to sleep.
+         */
+        lock_guard<mutex> lock(_mutex);
+    }
+    _wake.notify_all();
+    _thread.join();
+    delete[] _block;
+}
+
+int RenderThread::read(float* out, int count) {
+    int result = int(_ring.pop(out, max(count, 0)));
+    if (result > 0) {
+        _wake.notify_one();
+    }
+    return result;
+}
+
+bool RenderThread::setPriority(int priority) {
+#ifdef __linux__
+    sched_param param = {};
+    param.sched_priority = priority;
+    return pthread_setschedparam(_thread.native_handle(),
+                                 priority > 0 ? SCHED_FIFO : SCHED_OTHER,
+                                 &param) == 0;
+#else
+    (void) priority;
+    return false;
+#endif
+}
+
+bool RenderThread::setCore(int core) {
+#ifdef __linux__
+    if (core < 0 || core >= CPU_SETSIZE) return false;
+
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core, &cores);
+    return pthread_setaffinity_np(_thread.native_handle(), sizeof(cores), &cores) == 0;
+#else
+    (void) core;
+    return false;
+#endif
+}
+
+void RenderThread::run() {
+    while (!_stopping.load()) {
+        /* Top the ring up, a period at a time. */
+        while (!_stopping.load() && int(_ring.size()) + _periodFrames <= _aheadFrames) {
+            auto start = chrono::steady_clock::now();
+            _callback(_block, _periodFrames);
+            chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+            AudioBuffering::noteCallback(_periodFrames, elapsed.count());
+
+            _ring.push(_block, _periodFrames);
+        }
+
+        unique_lock<mutex> lock(_mutex);
+        if (!_stopping.load()) {
+            _wake.wait_for(lock, kIdleWait);
+        }
+    }
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include "GUI/SimpleTest.h"
+#include <vector>
+
+STUDENT_TEST("SPSCQueue moves runs of values in order, across the wraparound.") {
+    SPSCQueue<int> queue(8);
+    int values[] = {1, 2, 3, 4, 5, 6};
+    int results[8];
+
+    EXPECT_EQUAL(queue.push(values, 6), 6);
+    EXPECT_EQUAL(queue.pop(results, 4), 4);
+    EXPECT_EQUAL(results[3], 4);
+
+    /* Only six more fit, and they go around the end of the ring. */
+    EXPECT_EQUAL(queue.push(values, 6), 6);
+    EXPECT_EQUAL(queue.push(values, 6), 0);
+    EXPECT_EQUAL(queue.size(), 8);
+
+    EXPECT_EQUAL(queue.pop(results, 8), 8);
+    EXPECT_EQUAL(results[0], 5);
+    EXPECT_EQUAL(results[1], 6);
+    EXPECT_EQUAL(results[2], 1);
+    EXPECT_EQUAL(results[7], 6);
+    EXPECT_EQUAL(queue.pop(results, 8), 0);
+}
+
+STUDENT_TEST("RenderThread hands back the callback's samples in order, without gaps.") {
+    atomic<int> next{0};
+    RenderThread renderer([&](float* out, int count) {
+        for (int i = 0; i < count; i++) {
+            out[i] = float(next++);
+        }
+    }, 384, 128);
+
+    /* Read in sizes that don't line up with the period. */
+    vector<float> received;
+    float chunk[100];
+    while (received.size() < 5000) {
+        int count = renderer.read(chunk, 100);
+        EXPECT(count >= 0 && count <= 100);
+        received.insert(received.end(), chunk, chunk + count);
+        if (count == 0) this_thread::yield();
+    }
+
+    bool inOrder = true;
+    for (size_t i = 0; i < received.size(); i++) {
+        inOrder &= (received[i] == float(i));
+    }
+    EXPECT(inOrder);
+
+    /* Left alone, it fills to within a period of the target, and no further.
+     * Wait until the callback hasn't been asked for anything in a while, with
+     * a generous deadline so a busy machine doesn't fail the test.
+     */
+    auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+    int last = -1;
+    for (int quiet = 0; quiet < 10 && chrono::steady_clock::now() < deadline; ) {
+        this_thread::sleep_for(chrono::milliseconds(2));
+        int now = next.load();
+        quiet = now == last? quiet + 1 : 0;
+        last = now;
+    }
+    float all[1024];
+    int waiting = renderer.read(all, 1024);
+    EXPECT(waiting > 384 - 128 && waiting <= 384);
+}
+
+STUDENT_TEST("RenderThread insists on buffering at least one period.") {
+    auto silence = [](float* out, int count) {
+        fill(out, out + count, 0.0f);
+    };
+    EXPECT_ERROR(RenderThread(silence, 64, 128));
+    EXPECT_ERROR(RenderThread(silence, 64, 0));
+}
@@ -0,0 +1,67 @@
+/* File: RenderThread.h
+ *
+ * A thread that runs an audio callback ahead of the sound card, keeping a
+ * ring buffer of samples topped up. Whoever feeds the sound card then only
+ * has to copy samples out of the ring, so a busy Qt event loop (painting,
+ * mouse drags, and so on) can't hold up the synthesis itself.
+ *
+ * The ring is a lock-free single-producer, single-consumer queue: the render
+ * thread is the only producer, and read() must only ever be called from one
+ * thread at a time.
+ */
+#pragma once
+
+#include "AudioSystem.h"
+#include "SPSCQueue.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class RenderThread {
+public:
+    /* Starts a thread that calls the callback for periodFrames samples at a
+     * time until aheadFrames samples are waiting in the ring.
+     */
+    RenderThread(FloatAudioCallback callback, int aheadFrames, int periodFrames);
+
+    /* Stops and joins the thread. */
+    ~RenderThread();
+
+    /* Copies up to count waiting samples into out and returns how many that
+     * was. Never blocks; if the render thread has fallen behind, this returns
+     * fewer samples than were asked for, possibly none.
+     */
+    int read(float* out, int count);
+
+    /* Runs the thread at the given real-time priority, or at normal priority
+     * if it's zero. Returns whether the operating system went along with it;
+     * real-time priorities usually need special permissions. Only Linux is
+     * supported, and this returns false elsewhere.
+     */
+    bool setPriority(int priority);
+
+    /* Keeps the thread on the given core. Returns whether that worked, which
+     * it only can on Linux.
+     */
+    bool setCore(int core);
+
+    /* Not copyable; the thread points back at this object. */
+    RenderThread(const RenderThread&) = delete;
+    void operator= (const RenderThread&) = delete;
+
+private:
+    FloatAudioCallback _callback;
+    SPSCQueue<float> _ring;
+    int _aheadFrames;
+    int _periodFrames;
+    float* _block;      // Where each period is rendered before going in the ring
+
+    /* The thread sleeps here when the ring is full enough. */
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::atomic<bool> _stopping{false};
+    std::thread _thread;
+
+    void run();
+};
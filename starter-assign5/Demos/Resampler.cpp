@@ -0,0 +1,246 @@
+/* File: Resampler.cpp
+ *
+ * Implementation of the Resampler type.
+ *
+ * The filter is a windowed sinc, cut off a little below whichever of the two
+ * rates is lower so that nothing folds back over from above it. Each phase is
+ * scaled so that its taps add up to exactly one; otherwise the phases would
+ * disagree slightly about the level of a steady signal, and that disagreement
+ * would be heard as a faint tone.
+ */
+#include "Resampler.h"
+#include "error.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+#endif
+using namespace std;
+
+namespace {
+    /* Upper limit on the number of phases, which keeps the table at a few
+     * hundred kilobytes at most.
+     */
+    const int kMaxPhases = 1024;
+
+    /* Where the filter cuts off, as a fraction of the lower rate's limit. */
+    const double kCutoff = 0.9;
+
+    const double kPi = 3.14159265358979323846;
+
+    int greatestCommonDivisor(int a, int b) {
+        while (b != 0) {
+            int rest = a % b;
+            a = b;
+            b = rest;
+        }
+        return a;
+    }
+
+    double sinc(double x) {
+        return x == 0? 1.0 : sin(kPi * x) / (kPi * x);
+    }
+
+    /* Blackman window over n taps. */
+    double window(int index, int n) {
+        double x = double(index) / (n - 1);
+        return 0.42 - 0.5 * cos(2 * kPi * x) + 0.08 * cos(4 * kPi * x);
+    }
+
+    /* Multiplies the n taps by the n samples and adds up the results. */
+    float dot(const float* taps, const float* samples, int n) {
+        int i = 0;
+        float result = 0;
+
+#if defined(__AVX__)
+        __m256 sum = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(taps + i), _mm256_loadu_ps(samples + i)));
+        }
+        float lanes[8];
+        _mm256_storeu_ps(lanes, sum);
+        for (float lane: lanes) result += lane;
+#elif defined(__SSE2__)
+        __m128 sum = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(taps + i), _mm_loadu_ps(samples + i)));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, sum);
+        for (float lane: lanes) result += lane;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        float32x4_t sum = vdupq_n_f32(0);
+        for (; i + 4 <= n; i += 4) {
+            sum = vaddq_f32(sum, vmulq_f32(vld1q_f32(taps + i), vld1q_f32(samples + i)));
+        }
+        result = vaddvq_f32(sum);
+#endif
+
+        for (; i < n; i++) {
+            result += taps[i] * samples[i];
+        }
+        return result;
+    }
+}
+
+Resampler::Resampler(FloatAudioCallback source, int inputRate, int outputRate) : _source(source) {
+    if (inputRate <= 0 || outputRate <= 0) {
+        error("Sample rates must be positive.");
+    }
+
+    int common = greatestCommonDivisor(inputRate, outputRate);
+    _up   = outputRate / common;
+    _down = inputRate  / common;
+    if (_up > kMaxPhases) {
+        error("Can't convert from " + to_string(inputRate) + "Hz to " +
+              to_string(outputRate) + "Hz; the rates have too little in common.");
+    }
+    if (_down > kTapsPerPhase * _up) {
+        error("Can't lower the sample rate by more than a factor of " + to_string(kTapsPerPhase) + ".");
+    }
+
+    /* Design the whole filter at the stretched-out rate, then deal its taps
+     * out to the phases: tap j belongs to phase j % _up. Within a phase, taps
+     * go from oldest input to newest.
+     */
+    int length = kTapsPerPhase * _up;
+    double cutoff = kCutoff * 0.5 / max(_up, _down);
+    double center = (length - 1) / 2.0;
+
+    _taps = new float[length];
+    for (int phase = 0; phase < _up; phase++) {
+        double taps[kTapsPerPhase];
+        double total = 0;
+        for (int k = 0; k < kTapsPerPhase; k++) {
+            int j = phase + k * _up;
+            taps[k] = 2 * cutoff * sinc(2 * cutoff * (j - center)) * window(j, length);
+            total += taps[k];
+        }
+        for (int k = 0; k < kTapsPerPhase; k++) {
+            _taps[phase * kTapsPerPhase + (kTapsPerPhase - 1 - k)] = float(taps[k] / total);
+        }
+    }
+
+    /* Start with a window's worth of silence, so the first output lines up
+     * with the first input.
+     */
+    _input = new float[kTapsPerPhase + kInputBlock]();
+    _filled = kTapsPerPhase - 1;
+}
+
+Resampler::~Resampler() {
+    delete[] _taps;
+    delete[] _input;
+}
+
+/* Every output steps _down/_up input samples forward: _next moves ahead by the
+ * whole part, and _phase keeps track of the fraction. Outputs are clamped,
+ * since the filter can ring a little past the loudest input.
+ */
+void Resampler::render(float* out, int frames) {
+    for (int i = 0; i < frames; i++) {
+        if (_next + kTapsPerPhase > _filled) {
+            refill();
+        }
+
+        float sample = dot(_taps + _phase * kTapsPerPhase, _input + _next, kTapsPerPhase);
+        out[i] = min(1.0f, max(-1.0f, sample));
+
+        _phase += _down;
+        _next  += _phase / _up;
+        _phase %= _up;
+    }
+}
+
+/* Slides the samples that are still needed to the front of the buffer and
+ * reads another block after them. No output skips more than a window's worth
+ * of input, so nothing still needed is ever past _filled.
+ */
+void Resampler::refill() {
+    int keep = _filled - _next;
+    copy(_input + _next, _input + _filled, _input);
+    _source(_input + keep, kInputBlock);
+    _next = 0;
+    _filled = keep + kInputBlock;
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+
+namespace {
+    /* A source that plays a sine wave at the given frequency and rate. */
+    FloatAudioCallback sineWave(double frequency, int rate, int64_t& time) {
+        return [frequency, rate, &time](float* out, int frames) {
+            for (int i = 0; i < frames; i++, time++) {
+                out[i] = float(0.5 * sin(2 * kPi * frequency * time / rate));
+            }
+        };
+    }
+}
+
+STUDENT_TEST("Resampler passes a steady signal through at the same level.") {
+    const int kRates[][2] = { { 22050, 44100 }, { 44100, 22050 }, { 44100, 48000 }, { 88200, 44100 } };
+    for (auto& rates: kRates) {
+        Resampler resampler([](float* out, int frames) {
+            fill(out, out + frames, 0.5f);
+        }, rates[0], rates[1]);
+
+        float block[500];
+        resampler.render(block, 500);
+        for (int i = 2 * Resampler::kTapsPerPhase; i < 500; i++) {
+            EXPECT(fabs(block[i] - 0.5) < 1e-6);
+        }
+    }
+}
+
+STUDENT_TEST("Resampler keeps a tone in tune, delayed by half a window.") {
+    const int kRates[][2] = { { 22050, 44100 }, { 88200, 44100 }, { 44100, 48000 } };
+    for (auto& rates: kRates) {
+        int64_t time = 0;
+        Resampler resampler(sineWave(440, rates[0], time), rates[0], rates[1]);
+
+        /* The output lags by half the filter, measured at the stretched rate. */
+        double delay = (Resampler::kTapsPerPhase * resampler._up - 1) / 2.0 / resampler._up / rates[0];
+
+        float block[4000];
+        resampler.render(block, 4000);
+        for (int i = 200; i < 4000; i++) {
+            double expected = 0.5 * sin(2 * kPi * 440 * (double(i) / rates[1] - delay));
+            EXPECT(fabs(block[i] - expected) < 1e-3);
+        }
+    }
+}
+
+STUDENT_TEST("Resampler output doesn't depend on how it's split into calls.") {
+    int64_t wholeTime = 0, piecesTime = 0;
+    Resampler whole (sineWave(1000, 44100, wholeTime),  44100, 48000);
+    Resampler pieces(sineWave(1000, 44100, piecesTime), 44100, 48000);
+
+    float expected[3000], block[3000];
+    whole.render(expected, 3000);
+
+    int done = 0;
+    for (int size = 1; done < 3000; size = size * 3 % 401 + 1) {
+        int frames = min(size, 3000 - done);
+        pieces.render(block + done, frames);
+        done += frames;
+    }
+    for (int i = 0; i < 3000; i++) {
+        EXPECT_EQUAL(block[i], expected[i]);
+    }
+}
+
+STUDENT_TEST("Resampler rejects rates it can't handle.") {
+    auto silence = [](float* out, int frames) {
+        fill(out, out + frames, 0.0f);
+    };
+    EXPECT_ERROR(Resampler(silence, 0, 44100));
+    EXPECT_ERROR(Resampler(silence, 44100, -1));
+    EXPECT_ERROR(Resampler(silence, 44100, 44101));
+    EXPECT_ERROR(Resampler(silence, 44100 * 64, 44100));
+}
@@ -0,0 +1,71 @@
+/* File: Resampler.h
+ *
+ * Converts a stream of audio from one sample rate to another, so that an
+ * engine can synthesize at a rate of its own choosing: half the sound card's
+ * rate to save work, or twice it for cleaner highs. It pulls samples from an
+ * audio callback as it needs them, a block at a time, and hands back as many
+ * samples at the new rate as it's asked for.
+ *
+ * The conversion is a polyphase filter. Going from rate A to rate B is the
+ * same as stretching the input out by B / gcd(A, B), low-pass filtering it,
+ * and keeping every (A / gcd(A, B))th sample. Nearly all of the stretched
+ * samples are zeros, so each output sample only needs one row ("phase") of
+ * the filter, a handful of taps long, lined up against the latest input.
+ */
+#pragma once
+
+#include "AudioSystem.h"
+#include "GUI/SimpleTest.h"
+
+class Resampler {
+public:
+    /* Creates a resampler that calls source for samples at inputRate and
+     * produces them at outputRate. Reports an error if either rate isn't
+     * positive, or if the two rates have too little in common for the filter
+     * table to stay small (44100 and 48000 are fine).
+     */
+    Resampler(FloatAudioCallback source, int inputRate, int outputRate);
+
+    /* Frees the filter table and the input buffer. */
+    ~Resampler();
+
+    /* Writes the next frames samples at the output rate into out, calling
+     * the source as many times as it takes. The output doesn't depend on how
+     * it's split into calls.
+     */
+    void render(float* out, int frames);
+
+    /* How many input samples the source is asked for at a time. */
+    static const int kInputBlock = 256;
+
+    /* Taps in each phase of the filter. More taps means a sharper cutoff and
+     * a longer delay; the delay is half this many input samples.
+     */
+    static const int kTapsPerPhase = 32;
+
+    /* Not copyable; there's no need. */
+    Resampler(const Resampler&) = delete;
+    void operator= (const Resampler&) = delete;
+
+private:
+    FloatAudioCallback _source;
+    int _up;            // Output rate / gcd
+    int _down;          // Input rate / gcd
+
+    /* _up phases of kTapsPerPhase taps each. Taps are stored oldest input
+     * first, so each output is a plain dot product with the input buffer.
+     */
+    float* _taps = nullptr;
+
+    /* Input samples that may still be needed. _next is where the window for
+     * the next output starts, and _filled is how many samples are in use.
+     */
+    float* _input = nullptr;
+    int _next = 0;
+    int _filled = 0;
+    int _phase = 0;
+
+    void refill();
+
+    ALLOW_TEST_ACCESS();
+};
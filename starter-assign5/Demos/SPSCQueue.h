@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+/* A fixed-capacity, lock-free queue for passing messages from exactly one
+ * producer thread to exactly one consumer thread. Neither side ever blocks
+ * or allocates memory once the queue has been constructed, which makes it
+ * safe to use from the audio thread.
+ *
+ * push() may only be called from the producer thread, and pop() may only be
+ * called from the consumer thread.
+ */
+template <typename T> class SPSCQueue {
+public:
+    /* Creates a queue that can hold up to capacity elements. The capacity is
+     * rounded up to a power of two.
+     */
+    explicit SPSCQueue(std::size_t capacity);
+    ~SPSCQueue();
+
+    /* Producer side. Adds the value to the queue, returning false without
+     * doing anything if the queue is full.
+     */
+    bool push(const T& value);
+
+    /* Consumer side. Removes the oldest value from the queue and stores it in
+     * result, returning false without doing anything if the queue is empty.
+     */
+    bool pop(T& result);
+
+    /* Consumer side. Like pop(), but leaves the value in the queue. */
+    bool peek(T& result) const;
+
+    /* Producer side. Adds as many of the count values as there's room for,
+     * in order, and returns how many that was.
+     */
+    std::size_t push(const T* values, std::size_t count);
+
+    /* Consumer side. Removes up to count of the oldest values, storing them
+     * in order in results, and returns how many that was.
+     */
+    std::size_t pop(T* results, std::size_t count);
+
+    /* How many elements are in the queue. This is only a snapshot, but it's
+     * a lower bound for the consumer and an upper bound for the producer.
+     */
+    std::size_t size() const;
+
+    /* How many elements the queue can hold. */
+    std::size_t capacity() const;
+
+    SPSCQueue(const SPSCQueue&) = delete;
+    void operator= (const SPSCQueue&) = delete;
+
+private:
+    T* cells;
+    std::size_t mask;
+
+    /* head is only written by the consumer and tail only by the producer.
+     * They're kept on separate cache lines so the two threads don't fight
+     * over the same line.
+     */
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+};
+
+/* * * * * Implementation Below This Point * * * * */
+template <typename T>
+SPSCQueue<T>::SPSCQueue(std::size_t capacity) {
+    std::size_t size = 1;
+    while (size < capacity) size *= 2;
+
+    cells = new T[size];
+    mask  = size - 1;
+}
+
+template <typename T>
+SPSCQueue<T>::~SPSCQueue() {
+    delete[] cells;
+}
+
+template <typename T>
+bool SPSCQueue<T>::push(const T& value) {
+    std::size_t back  = tail.load(std::memory_order_relaxed);
+    std::size_t front = head.load(std::memory_order_acquire);
+    if (back - front > mask) return false;
+
+    cells[back & mask] = value;
+    tail.store(back + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SPSCQueue<T>::pop(T& result) {
+    std::size_t front = head.load(std::memory_order_relaxed);
+    std::size_t back  = tail.load(std::memory_order_acquire);
+    if (front == back) return false;
+
+    result = cells[front & mask];
+    head.store(front + 1, std::memory_order_release);
+    return true;
+}
+
+template <typename T>
+bool SPSCQueue<T>::peek(T& result) const {
+    std::size_t front = head.load(std::memory_order_relaxed);
+    std::size_t back  = tail.load(std::memory_order_acquire);
+    if (front == back) return false;
+
+    result = cells[front & mask];
+    return true;
+}
+
+template <typename T>
+std::size_t SPSCQueue<T>::push(const T* values, std::size_t count) {
+    std::size_t back  = tail.load(std::memory_order_relaxed);
+    std::size_t front = head.load(std::memory_order_acquire);
+    count = std::min(count, capacity() - (back - front));
+
+    for (std::size_t i = 0; i < count; i++) {
+        cells[(back + i) & mask] = values[i];
+    }
+    tail.store(back + count, std::memory_order_release);
+    return count;
+}
+
+template <typename T>
+std::size_t SPSCQueue<T>::pop(T* results, std::size_t count) {
+    std::size_t front = head.load(std::memory_order_relaxed);
+    std::size_t back  = tail.load(std::memory_order_acquire);
+    count = std::min(count, back - front);
+
+    for (std::size_t i = 0; i < count; i++) {
+        results[i] = cells[(front + i) & mask];
+    }
+    head.store(front + count, std::memory_order_release);
+    return count;
+}
+
+template <typename T>
+std::size_t SPSCQueue<T>::size() const {
+    std::size_t front = head.load(std::memory_order_acquire);
+    std::size_t back  = tail.load(std::memory_order_acquire);
+    return back - front;
+}
+
+template <typename T>
+std::size_t SPSCQueue<T>::capacity() const {
+    return mask + 1;
+}
@@ -2,6 +2,20 @@
 
 #include "GUI/MemoryDiagnostics.h"
 
+/* Arrays of Samples are allocated from the waveform pool rather than straight
+ * from the heap; see WaveformPool.h. This has to come before Sample itself so
+ * that TRACK_ALLOCATIONS_OF picks it up.
+ */
+class Sample;
+namespace MemoryDiagnostics {
+    template <> struct Allocator<Sample> {
+        static void* scalarAlloc(std::size_t bytes);
+        static void* vectorAlloc(std::size_t bytes);
+        static void scalarFree(void* memory);
+        static void vectorFree(void* memory);
+    };
+}
+
 /* Type representing a single sound sample. We use this type instead of the
  * more familiar 'double' for two reasons:
  *
@@ -0,0 +1,61 @@
+/* File: SampleRate.cpp
+ *
+ * Storage for the global sample rate. Any thread, including the audio thread,
+ * can read it without locking or waiting on the Qt GUI thread.
+ *
+ * The rate and a version number are packed into a single 64-bit atomic, with
+ * the version in the high half, so a reader always sees a rate together with
+ * the version that published it.
+ */
+#include "AudioSystem.h"
+#include "error.h"
+#include <atomic>
+#include <cstdint>
+using namespace std;
+
+namespace {
+    const int kDefaultSampleRate = 44100;
+
+    atomic<uint64_t> theSampleRate{kDefaultSampleRate};
+    static_assert(atomic<uint64_t>::is_always_lock_free,
+                  "Sample rate must be readable from the audio thread without locking.");
+
+    int rateOf(uint64_t packed) {
+        return static_cast<int>(packed & 0xFFFFFFFFu);
+    }
+
+    unsigned versionOf(uint64_t packed) {
+        return static_cast<unsigned>(packed >> 32);
+    }
+}
+
+int AudioSystem::sampleRate() {
+    return rateOf(theSampleRate.load(memory_order_acquire));
+}
+
+int AudioSystem::sampleRate(unsigned& version) {
+    uint64_t packed = theSampleRate.load(memory_order_acquire);
+    version = versionOf(packed);
+    return rateOf(packed);
+}
+
+unsigned AudioSystem::sampleRateVersion() {
+    return versionOf(theSampleRate.load(memory_order_acquire));
+}
+
+void AudioSystem::setSampleRate(int rate) {
+    if (rate <= 0) {
+        error("Sample rate must be positive.");
+    }
+
+    /* Bump the version even if the rate is unchanged; it's cheap, and it
+     * means "the version changed" is exactly "someone set the rate."
+     */
+    uint64_t packed = theSampleRate.load(memory_order_relaxed);
+    uint64_t next;
+    do {
+        next = (uint64_t(versionOf(packed) + 1) << 32) | static_cast<uint32_t>(rate);
+    } while (!theSampleRate.compare_exchange_weak(packed, next,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
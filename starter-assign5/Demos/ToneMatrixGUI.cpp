@@ -1,11 +1,14 @@
 #include "ToneMatrix.h"
 #include "AudioSystem.h"
+#include "AudioMetrics.h"
 #include "GUI/MiniGUI.h"
 #include "DrawRectangle.h"
 #include "gthread.h"
 #include "ginteractors.h"
+#include "gtimer.h"
 #include "map.h"
 #include <algorithm>
+#include <sstream>
 using namespace std;
 
 namespace {
@@ -19,6 +22,13 @@ namespace {
 
     const int kGridSizes[] = {4, 6, 8, 9, 12, 16, 18};
 
+    /* Audio stats overlay: how it looks and how often it's refreshed. */
+    const Font   kStatsFont(FontFamily::MONOSPACE, FontStyle::NORMAL, 12, Color(0xC0, 0xC0, 0xC0));
+    const Color  kStatsBackground(0x00, 0x00, 0x00);
+    const double kStatsLineHeight = 16;
+    const double kStatsWidth      = 480;
+    const int    kStatsRefreshMS  = 500;
+
     class GUI: public ProblemHandler {
     public:
         GUI(GWindow& window) : ProblemHandler(window) {
@@ -35,9 +45,20 @@ namespace {
                 add(button);
             }
 
+            /* Audio stats, off by default. */
+            showStats = new GCheckBox("Show audio stats");
+            add(showStats);
+
             /* This is a standard high-fidelity sample rate. */
             AudioSystem::setSampleRate(44100);
 
+            /* Start with about 25ms of buffering so clicks are heard right
+             * away, and let it grow to 100ms on machines that can't keep up.
+             */
+            AudioSystem::setBufferFrames(1024);
+            AudioSystem::setPeriodFrames(256);
+            AudioSystem::setTargetLatency(0.1);
+
             /* Figure out the size of the biggest square that
              * (1) fits into the window and
              * (2) has a size that's a multiple of the grid size.
@@ -54,27 +75,59 @@ namespace {
             baseX = kWindowBorderPadding + (window.getCanvasWidth()  - 2 * kWindowBorderPadding - cellSize * gridSize) / 2;
             baseY = kWindowBorderPadding + (window.getCanvasHeight() - 2 * kWindowBorderPadding - cellSize * gridSize) / 2;
 
-            /* Hook ToneMatrix::draw() into the graphics system. */
-            setDrawFunction([&](Rectangle bounds, Color color) {
-                window.setColor(color.toRGB());
-                window.fillRect(bounds.x + baseX, bounds.y + baseY, bounds.width, bounds.height);
-
-                window.setColor(Color(color.red() / 2, color.green() / 2, color.blue() / 2).toRGB());
-                window.drawRect(bounds.x + baseX, bounds.y + baseY, bounds.width, bounds.height);
-            });
-
-            /* Hook it into the audio system as well. */
-            AudioSystem::play([=](double* buffer, int toRead) {
-                for (int i = 0; i < toRead; i++) {
-                    buffer[i] = matrix->nextSample();
+            /* Hook ToneMatrix::draw() into the graphics system. A batch usually
+             * only has a couple of colors in it, so rather than switching the
+             * pen color twice per rectangle, draw everything of one color at
+             * once.
+             */
+            setBatchDrawFunction([&](const Rectangle* bounds, const Color* colors, int count) {
+                for (int first = 0; first < count; first++) {
+                    /* Only handle each color the first time it shows up. */
+                    Color color = colors[first];
+                    if (find(colors, colors + first, color) != colors + first) continue;
+
+                    window.setColor(color.toRGB());
+                    for (int i = first; i < count; i++) {
+                        if (colors[i] == color) {
+                            window.fillRect(bounds[i].x + baseX, bounds[i].y + baseY, bounds[i].width, bounds[i].height);
+                        }
+                    }
+
+                    window.setColor(Color(color.red() / 2, color.green() / 2, color.blue() / 2).toRGB());
+                    for (int i = first; i < count; i++) {
+                        if (colors[i] == color) {
+                            window.drawRect(bounds[i].x + baseX, bounds[i].y + baseY, bounds[i].width, bounds[i].height);
+                        }
+                    }
                 }
             });
+
+            /* Hook it into the audio system as well. The matrix renders on
+             * the audio system's render thread, so repainting doesn't hold up
+             * the sound. If it's been given a render rate of its own, its
+             * output is resampled for the sound card.
+             */
+            AudioSystem::playFloat([=](float* buffer, int toRead) {
+                matrix->render(buffer, toRead);
+                AudioMetrics::recordVoices(matrix->activeVoices());
+            }, matrix->renderRate());
+
+            /* Keeps the stats overlay up to date while it's showing, and
+             * notices if the sound card's rate changes.
+             */
+            AudioMetrics::reset();
+            timer = new GTimer(kStatsRefreshMS);
+            timer->start();
         }
 
         ~GUI() {
+            GThread::runOnQtGuiThread([this] {
+                timer->stop();
+            });
+            delete timer;
             AudioSystem::stop();
             delete matrix;
-            setDrawFunction(nullptr);
+            setBatchDrawFunction(nullptr);
         }
 
         /* Forward mouse presses to the Tone Matrix. */
@@ -101,22 +154,53 @@ namespace {
             }
         }
 
-        /* Use the ToneMatrix::draw() to render to the canvas. */
+        /* Use the ToneMatrix to render to the canvas. The canvas keeps what was
+         * drawn last time, so usually only the lights that changed are redrawn.
+         */
         void repaint() override {
-            window().clearCanvas();
-            window().setColor(kBackgroundColor.toRGB());
-            window().fillRect(canvasBounds());
-            matrix->draw();
+            if (needsClear) {
+                window().clearCanvas();
+                window().setColor(kBackgroundColor.toRGB());
+                window().fillRect(canvasBounds());
+                matrix->markAllDirty();
+                needsClear = false;
+            }
+            matrix->drawDirty();
+
+            if (showStats->isChecked()) {
+                drawStats();
+            }
+        }
+
+        void timerFired() override {
+            GThread::runOnQtGuiThread([&] {
+                matrix->retuneIfNeeded();
+            });
+            if (showStats->isChecked()) {
+                requestRepaint();
+            }
+        }
+
+        /* The canvas has been resized, so start over from a blank slate. */
+        void windowResized() override {
+            needsClear = true;
+            requestRepaint();
         }
 
         /* Allow the user to change the dimensions. */
         void changeOccurredIn(GObservable* source) override {
-            if (sizeMap.containsKey(source)) {
+            /* Hiding the stats means redrawing what was under them. */
+            if (source == showStats) {
+                needsClear = true;
+                requestRepaint();
+            }
+            else if (sizeMap.containsKey(source)) {
                 GThread::runOnQtGuiThread([&] {
                     gridSize = sizeMap[source];
                     baseX = kWindowBorderPadding + (window().getCanvasWidth()  - 2 * kWindowBorderPadding - cellSize * gridSize) / 2;
                     baseY = kWindowBorderPadding + (window().getCanvasHeight() - 2 * kWindowBorderPadding - cellSize * gridSize) / 2;
                     matrix->resize(gridSize);
+                    needsClear = true;
                     requestRepaint();
                 });
             }
@@ -125,8 +209,35 @@ namespace {
     private:
         int baseX, baseY, cellSize, gridSize;
 
+        /* Whether the whole canvas has to be cleared and redrawn. */
+        bool needsClear = true;
+
         ToneMatrix* matrix;
         Map<GObservable*, int> sizeMap;
+
+        GCheckBox* showStats;
+        GTimer* timer;
+
+        /* Draws the audio stats in the top-left corner, along with the grid
+         * size, so that dropouts can be matched up with what was playing.
+         */
+        void drawStats() {
+            vector<string> lines = { "Grid:     " + to_string(gridSize) + " x " + to_string(gridSize) };
+            istringstream report(AudioMetrics::report(AudioMetrics::snapshot()));
+            for (string line; getline(report, line); ) {
+                lines.push_back(line);
+            }
+
+            window().setColor(kStatsBackground.toRGB());
+            window().fillRect(0, 0, kStatsWidth, kStatsLineHeight * (lines.size() + 1));
+
+            for (size_t i = 0; i < lines.size(); i++) {
+                GRectangle bounds(kStatsLineHeight / 2, kStatsLineHeight * (i + 0.5), kStatsWidth, kStatsLineHeight);
+                auto render = TextRender::construct(lines[i], bounds, kStatsFont, LineBreak::NO_BREAK_SPACES);
+                render->alignLeft();
+                render->draw(window());
+            }
+        }
     };
 }
 
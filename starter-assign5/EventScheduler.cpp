@@ -0,0 +1,327 @@
+/* File: EventScheduler.cpp
+ *
+ * Implementation of the EventScheduler type.
+ */
+#include "EventScheduler.h"
+#include "Demos/AudioSystem.h"
+#include "error.h"
+#include <cmath>
+using namespace std;
+
+bool operator== (const Tempo& lhs, const Tempo& rhs) {
+    return lhs.bpm          == rhs.bpm &&
+           lhs.stepsPerBeat == rhs.stepsPerBeat &&
+           lhs.stepSamples  == rhs.stepSamples &&
+           lhs.swing        == rhs.swing;
+}
+
+bool operator!= (const Tempo& lhs, const Tempo& rhs) {
+    return !(lhs == rhs);
+}
+
+void checkTempo(const Tempo& tempo) {
+    if (tempo.bpm < 0) {
+        error("Tempo can't be negative.");
+    }
+    if (tempo.stepsPerBeat <= 0) {
+        error("There must be at least one step per beat.");
+    }
+    if (tempo.bpm == 0 && tempo.stepSamples < 1) {
+        error("Steps must be at least one sample long.");
+    }
+    if (tempo.swing < 0 || tempo.swing >= 1) {
+        error("Swing must be at least 0 and less than 1.");
+    }
+}
+
+EventScheduler::EventScheduler() {
+    restart();
+}
+
+void EventScheduler::restart() {
+    _numEvents = 0;
+    _exactTime = 0;
+    _stepTime  = 0;
+
+    if (_tempoPending) {
+        applyTempo();
+    }
+
+    push(0, EventType::PLUCK);
+    push(0, EventType::ADVANCE);
+}
+
+int64_t EventScheduler::nextEventTime() const {
+    return _events[0].time;
+}
+
+bool EventScheduler::popEventAt(int64_t time, Event& event) {
+    if (_numEvents == 0 || _events[0].time != time) return false;
+
+    event = _events[0];
+    for (int i = 1; i < _numEvents; i++) {
+        _events[i - 1] = _events[i];
+    }
+    _numEvents--;
+    return true;
+}
+
+void EventScheduler::scheduleStep(int col, double scale) {
+    _exactTime += stepLength(col, scale);
+
+    /* However short the step, time has to move forward. */
+    int64_t time = llround(_exactTime);
+    if (time <= _stepTime) {
+        time = _stepTime + 1;
+        _exactTime = time;
+    }
+    _stepTime = time;
+
+    push(time, EventType::PLUCK);
+    push(time, EventType::ADVANCE);
+}
+
+void EventScheduler::setTempo(const Tempo& tempo) {
+    checkTempo(tempo);
+    if (tempo == (_tempoPending? _nextTempo : _tempo)) return;
+
+    _nextTempo = tempo;
+
+    /* The change happens when the next step starts. If it's already on the
+     * calendar there's nothing more to do.
+     */
+    if (!_tempoPending) {
+        _tempoPending = true;
+        for (int i = 0; i < _numEvents; i++) {
+            if (_events[i].type == EventType::PLUCK) {
+                push(_events[i].time, EventType::TEMPO_CHANGE);
+                return;
+            }
+        }
+        push(_stepTime, EventType::TEMPO_CHANGE);
+    }
+}
+
+void EventScheduler::applyTempo() {
+    _tempo = _nextTempo;
+    _tempoPending = false;
+}
+
+const Tempo& EventScheduler::tempo() const {
+    return _tempo;
+}
+
+void EventScheduler::setSampleRate(int rate) {
+    if (rate < 0) {
+        error("Sample rate can't be negative.");
+    }
+    _sampleRate = rate;
+}
+
+/* Adds an event, keeping the list sorted by time and then by type. */
+void EventScheduler::push(int64_t time, EventType type) {
+    if (_numEvents == kMaxEvents) {
+        error("Internal error: too many scheduled events.");
+    }
+
+    int pos = _numEvents;
+    while (pos > 0 && (_events[pos - 1].time > time ||
+                       (_events[pos - 1].time == time && _events[pos - 1].type > type))) {
+        _events[pos] = _events[pos - 1];
+        pos--;
+    }
+    _events[pos] = { time, type };
+    _numEvents++;
+}
+
+/* Length of the step being scheduled, for the given column, in samples. */
+double EventScheduler::stepLength(int col, double scale) const {
+    double rate = _sampleRate > 0? _sampleRate : AudioSystem::sampleRate();
+    double length = _tempo.bpm > 0?
+                    rate * 60.0 / (_tempo.bpm * _tempo.stepsPerBeat) :
+                    _tempo.stepSamples;
+    if (_sampleRate > 0 && _tempo.bpm == 0) {
+        length *= rate / AudioSystem::sampleRate();
+    }
+
+    double swing = col % 2 == 0? 1 + _tempo.swing : 1 - _tempo.swing;
+    return length * scale * swing;
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+
+namespace {
+    /* Runs the scheduler the way a renderer would, sweeping across the given
+     * number of columns and answering every ADVANCE with the given scale, and
+     * returns the times of the first count plucks.
+     */
+    int64_t* pluckTimes(EventScheduler& schedule, int count, double scale = 1.0, int columns = 16) {
+        int64_t* result = new int64_t[count];
+        int found = 0;
+        int col = 0;
+        while (found < count) {
+            int64_t now = schedule.nextEventTime();
+            EventScheduler::Event event;
+            while (schedule.popEventAt(now, event)) {
+                if (event.type == EventScheduler::EventType::PLUCK && found < count) {
+                    result[found++] = now;
+                } else if (event.type == EventScheduler::EventType::ADVANCE) {
+                    schedule.scheduleStep(col, scale);
+                    col = (col + 1) % columns;
+                } else if (event.type == EventScheduler::EventType::TEMPO_CHANGE) {
+                    schedule.applyTempo();
+                }
+            }
+        }
+        return result;
+    }
+}
+
+STUDENT_TEST("EventScheduler defaults to a step every 8192 samples.") {
+    AudioSystem::setSampleRate(44100);
+
+    EventScheduler schedule;
+    EXPECT_EQUAL(schedule.nextEventTime(), 0);
+
+    /* Events at the same time come out pluck first, then advance. */
+    EventScheduler::Event event;
+    EXPECT(!schedule.popEventAt(1, event));
+    EXPECT(schedule.popEventAt(0, event));
+    EXPECT(event.type == EventScheduler::EventType::PLUCK);
+    EXPECT(schedule.popEventAt(0, event));
+    EXPECT(event.type == EventScheduler::EventType::ADVANCE);
+    EXPECT(!schedule.popEventAt(0, event));
+
+    schedule.restart();
+    int64_t* times = pluckTimes(schedule, 5);
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQUAL(times[i], 8192 * i);
+    }
+    delete[] times;
+}
+
+STUDENT_TEST("EventScheduler follows BPM without drifting.") {
+    AudioSystem::setSampleRate(44100);
+
+    /* At 140 BPM in sixteenth notes, a step is 4725 samples exactly, and
+     * at 97 BPM it's a fraction, so rounding errors could pile up.
+     */
+    EventScheduler schedule;
+    Tempo tempo;
+    tempo.bpm = 140;
+    schedule.setTempo(tempo);
+    schedule.restart();
+
+    int64_t* times = pluckTimes(schedule, 4);
+    EXPECT_EQUAL(times[3], 3 * 4725);
+    delete[] times;
+
+    tempo.bpm = 97;
+    schedule.setTempo(tempo);
+    schedule.restart();
+    times = pluckTimes(schedule, 1001);
+    double exact = 44100 * 60.0 / (97 * 4);
+    EXPECT_EQUAL(times[1000], llround(1000 * exact));
+    delete[] times;
+
+    tempo.bpm = -1;
+    EXPECT_ERROR(schedule.setTempo(tempo));
+}
+
+STUDENT_TEST("EventScheduler keeps steps the same length in seconds at any rate.") {
+    AudioSystem::setSampleRate(44100);
+
+    /* At half the rate, a step has half as many samples. */
+    EventScheduler schedule;
+    schedule.setSampleRate(22050);
+    schedule.restart();
+    int64_t* times = pluckTimes(schedule, 3);
+    EXPECT_EQUAL(times[2], 8192);
+    delete[] times;
+
+    Tempo tempo;
+    tempo.bpm = 140;
+    schedule.setTempo(tempo);
+    schedule.restart();
+    times = pluckTimes(schedule, 3);
+    EXPECT_EQUAL(times[2], 4725);
+    delete[] times;
+
+    /* Zero goes back to following the sample rate. */
+    schedule.setSampleRate(0);
+    schedule.restart();
+    times = pluckTimes(schedule, 3);
+    EXPECT_EQUAL(times[2], 2 * 4725);
+    delete[] times;
+
+    EXPECT_ERROR(schedule.setSampleRate(-1));
+}
+
+STUDENT_TEST("EventScheduler applies swing and per-column lengths.") {
+    AudioSystem::setSampleRate(44100);
+
+    EventScheduler schedule;
+    Tempo tempo;
+    tempo.stepSamples = 1000;
+    tempo.swing = 0.25;
+    schedule.setTempo(tempo);
+    schedule.restart();
+
+    /* Long, short, long, short... */
+    int64_t* times = pluckTimes(schedule, 5);
+    EXPECT_EQUAL(times[1], 1250);
+    EXPECT_EQUAL(times[2], 2000);
+    EXPECT_EQUAL(times[3], 3250);
+    EXPECT_EQUAL(times[4], 4000);
+    delete[] times;
+
+    /* Doubling each column's length doubles everything. */
+    schedule.restart();
+    times = pluckTimes(schedule, 3, 2.0);
+    EXPECT_EQUAL(times[1], 2500);
+    EXPECT_EQUAL(times[2], 4000);
+    delete[] times;
+
+    /* With an odd number of columns, column 0 stays long as the sweep wraps
+     * around, so two long steps come in a row.
+     */
+    schedule.restart();
+    times = pluckTimes(schedule, 6, 1.0, 3);
+    EXPECT_EQUAL(times[1], 1250);
+    EXPECT_EQUAL(times[2], 2000);
+    EXPECT_EQUAL(times[3], 3250);
+    EXPECT_EQUAL(times[4], 4500);
+    EXPECT_EQUAL(times[5], 5250);
+    delete[] times;
+}
+
+STUDENT_TEST("EventScheduler changes tempo at the next step boundary.") {
+    AudioSystem::setSampleRate(44100);
+
+    EventScheduler schedule;
+
+    /* Get the first step under way. */
+    EventScheduler::Event event;
+    schedule.popEventAt(0, event);
+    schedule.popEventAt(0, event);
+    schedule.scheduleStep(0, 1.0);
+
+    /* Ask for shorter steps partway through. The current step still ends
+     * on time, with the tempo change just before the pluck.
+     */
+    Tempo tempo;
+    tempo.stepSamples = 100;
+    schedule.setTempo(tempo);
+    EXPECT_EQUAL(schedule.nextEventTime(), 8192);
+    EXPECT(schedule.popEventAt(8192, event));
+    EXPECT(event.type == EventScheduler::EventType::TEMPO_CHANGE);
+    schedule.applyTempo();
+    EXPECT_EQUAL(schedule.tempo().stepSamples, 100);
+
+    EXPECT(schedule.popEventAt(8192, event));
+    EXPECT(event.type == EventScheduler::EventType::PLUCK);
+    EXPECT(schedule.popEventAt(8192, event));
+    schedule.scheduleStep(1, 1.0);
+    EXPECT_EQUAL(schedule.nextEventTime(), 8292);
+}
@@ -0,0 +1,130 @@
+/* File: EventScheduler.h
+ *
+ * Keeps track of when things happen in the Tone Matrix's sweep: when the next
+ * column gets plucked, when the sweep moves on to the following column, and
+ * when a new tempo kicks in. Each of those is an event stamped with the sample
+ * it happens on, so a renderer can run uninterrupted right up to the next
+ * event instead of checking the time on every sample.
+ *
+ * Steps are either a fixed number of samples long or derived from a tempo in
+ * beats per minute. Swing stretches the steps of even-numbered columns and
+ * shortens those of odd-numbered ones by the same amount, and each column can
+ * be given a longer or shorter step than the others.
+ */
+#pragma once
+
+#include "GUI/SimpleTest.h"
+#include <cstdint>
+
+/* How fast the sweep moves. */
+struct Tempo {
+    /* Beats per minute, or 0 to make each step stepSamples samples long. */
+    double bpm = 0;
+
+    /* How many columns make up one beat when bpm is used. */
+    int stepsPerBeat = 4;
+
+    /* Length of a step, in samples, when bpm is 0. */
+    double stepSamples = 8192;
+
+    /* How far to swing, from 0 (straight) up to but not including 1. Steps
+     * for even columns last (1 + swing) times as long as usual and steps for
+     * odd columns last (1 - swing) times as long, so each pair of columns
+     * keeps its length.
+     */
+    double swing = 0;
+};
+
+bool operator== (const Tempo& lhs, const Tempo& rhs);
+bool operator!= (const Tempo& lhs, const Tempo& rhs);
+
+/* Reports an error if the tempo doesn't make sense. */
+void checkTempo(const Tempo& tempo);
+
+class EventScheduler {
+public:
+    /* Kinds of events. Events at the same time come out in this order. */
+    enum class EventType {
+        TEMPO_CHANGE,   // Switch over to the tempo passed to setTempo()
+        PLUCK,          // Pluck the current column
+        ADVANCE         // Move on to the next column and call scheduleStep()
+    };
+
+    struct Event {
+        int64_t time;
+        EventType type;
+    };
+
+    /* Creates a scheduler using the default tempo, with the first step
+     * starting at time 0.
+     */
+    EventScheduler();
+
+    /* Forgets all pending events and starts over with a step at time 0.
+     * A tempo change that hasn't happened yet takes effect immediately.
+     */
+    void restart();
+
+    /* Time of the earliest pending event. */
+    int64_t nextEventTime() const;
+
+    /* If the earliest pending event happens at the given time, removes it,
+     * stores it in event, and returns true. Otherwise returns false.
+     */
+    bool popEventAt(int64_t time, Event& event);
+
+    /* Schedules the next step to start once the current one, which plays
+     * the given column, is over. Swing depends on the column rather than on
+     * how many steps there have been, so a grid with an odd number of columns
+     * swings the same way on every pass. The current step's usual length is
+     * also multiplied by scale, which lets some columns last longer than
+     * others.
+     */
+    void scheduleStep(int col, double scale);
+
+    /* Arranges for the tempo to change at the start of the next step, so
+     * that the step in progress isn't cut short.
+     */
+    void setTempo(const Tempo& tempo);
+
+    /* Switches over to the tempo passed to setTempo(). Call this when a
+     * TEMPO_CHANGE event comes up.
+     */
+    void applyTempo();
+
+    /* The tempo in effect right now. */
+    const Tempo& tempo() const;
+
+    /* Has the scheduler count samples at the given rate, for an engine that
+     * renders at a rate of its own, rather than at AudioSystem::sampleRate().
+     * Steps last just as long in seconds either way: beats per minute are
+     * converted at this rate, and stepSamples, which counts samples at
+     * AudioSystem::sampleRate(), is stretched to match. Zero, the default,
+     * goes back to AudioSystem::sampleRate(). Takes effect at the next step.
+     */
+    void setSampleRate(int rate);
+
+private:
+    /* Pending events in order of time, then type. There's never more than
+     * one of each type waiting, so this never needs to grow.
+     */
+    static const int kMaxEvents = 4;
+    Event _events[kMaxEvents];
+    int _numEvents = 0;
+
+    Tempo _tempo;
+    Tempo _nextTempo;
+    bool _tempoPending = false;
+    int _sampleRate = 0;
+
+    /* The exact (fractional) time the latest step starts. Event times are
+     * rounded from this so that fractional step lengths don't drift.
+     */
+    double _exactTime = 0;
+    int64_t _stepTime = 0;
+
+    void push(int64_t time, EventType type);
+    double stepLength(int col, double scale) const;
+
+    ALLOW_TEST_ACCESS();
+};
@@ -0,0 +1,16 @@
+###############################################################################
+# Project file for the headless renderer (Tools/HeadlessRender.cpp)
+#
+# Renders a Tone Matrix pattern to a .wav file without a window or a sound
+# card. Built separately from Tone Matrix.pro, which skips the Tools folder.
+###############################################################################
+
+TARGET      =   HeadlessRender
+
+include(Tools/Tool.pri)
+
+SOURCES     +=  Tools/HeadlessRender.cpp \
+                Tools/WavWriter.cpp
+HEADERS     +=  Tools/WavWriter.h
+
+OTHER_FILES *=  $$files(res/patterns/*)
@@ -0,0 +1,197 @@
+/* File: KarplusStrong.cpp
+ *
+ * Vectorized implementation of the Karplus-Strong inner loop. Within a run
+ * that doesn't wrap around, the new value of each slot only depends on the
+ * old values of that slot and the next one, so there is no dependency from
+ * one slot to the next and we can update several slots per instruction.
+ *
+ * Every lane performs the same operations in the same order as the scalar
+ * code ((a + b) / 2, then times decay), so the results are bit-for-bit the
+ * same as the one-sample-at-a-time version.
+ */
+#include "KarplusStrong.h"
+#include <algorithm>
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    #include <arm_neon.h>
+#endif
+
+namespace KarplusStrong {
+    namespace {
+        /* Plain version, used for the leftovers at the end of each run and on
+         * platforms without vector instructions.
+         */
+        template <typename T> void advanceScalar(T* wave, T* out, int n, T decay, bool accumulate) {
+            if (accumulate) {
+                for (int i = 0; i < n; i++) {
+                    T thisOne = wave[i];
+                    wave[i] = decay * ((thisOne + wave[i + 1]) / 2);
+                    out[i] += thisOne;
+                }
+            } else {
+                for (int i = 0; i < n; i++) {
+                    T thisOne = wave[i];
+                    wave[i] = decay * ((thisOne + wave[i + 1]) / 2);
+                    out[i] = thisOne;
+                }
+            }
+        }
+
+        /* Runs n slots that were just written back through the allpass. Each
+         * output depends on the one before, so this one can't be vectorized;
+         * it's one multiply and two adds per slot.
+         */
+        template <typename T> void filter(T* wave, int n, Allpass<T>& allpass) {
+            T coefficient = allpass.coefficient;
+            T lastIn      = allpass.lastIn;
+            T lastOut     = allpass.lastOut;
+            for (int i = 0; i < n; i++) {
+                T in = wave[i];
+                lastOut = coefficient * (in - lastOut) + lastIn;
+                lastIn  = in;
+                wave[i] = lastOut;
+            }
+            allpass.lastIn  = lastIn;
+            allpass.lastOut = lastOut;
+        }
+
+        /* Splits the work up at the wraparound point. The same for both
+         * precisions. If there's an allpass, each run is filtered right after
+         * it's advanced. That's safe because advancing a slot only reads the
+         * old value of the slot after it, which the filter hasn't touched yet.
+         */
+        template <typename T> void renderRuns(T* wave, int length, int& cursor, T* out, int n, T decay,
+                                              Allpass<T>* allpass, bool accumulate) {
+            int done = 0;
+            while (done < n) {
+                /* The last slot reads from slot 0 and sends the cursor back to the start. */
+                if (cursor == length - 1) {
+                    T thisOne = wave[cursor];
+                    wave[cursor] = decay * ((thisOne + wave[0]) / 2);
+                    out[done] = accumulate ? out[done] + thisOne : thisOne;
+                    if (allpass != nullptr) filter(wave + cursor, 1, *allpass);
+                    cursor = 0;
+                    done++;
+                    continue;
+                }
+
+                /* Everything from here up to the last slot is one contiguous run. */
+                int run = std::min(n - done, length - 1 - cursor);
+                advance(wave + cursor, out + done, run, decay, accumulate);
+                if (allpass != nullptr) filter(wave + cursor, run, *allpass);
+
+                cursor += run;
+                done += run;
+            }
+        }
+    }
+
+    /* The filter's delay at low frequencies is (1 - a) / (1 + a). */
+    double allpassCoefficient(double delay) {
+        return (1 - delay) / (1 + delay);
+    }
+
+    void advance(double* wave, double* out, int n, double decay, bool accumulate) {
+        int i = 0;
+
+#if defined(__AVX__)
+        const __m256d half   = _mm256_set1_pd(0.5);
+        const __m256d factor = _mm256_set1_pd(decay);
+        for (; i + 4 <= n; i += 4) {
+            __m256d here = _mm256_loadu_pd(wave + i);
+            __m256d next = _mm256_loadu_pd(wave + i + 1);
+            _mm256_storeu_pd(wave + i, _mm256_mul_pd(factor, _mm256_mul_pd(_mm256_add_pd(here, next), half)));
+
+            __m256d mixed = accumulate ? _mm256_add_pd(_mm256_loadu_pd(out + i), here) : here;
+            _mm256_storeu_pd(out + i, mixed);
+        }
+#elif defined(__SSE2__)
+        const __m128d half   = _mm_set1_pd(0.5);
+        const __m128d factor = _mm_set1_pd(decay);
+        for (; i + 2 <= n; i += 2) {
+            __m128d here = _mm_loadu_pd(wave + i);
+            __m128d next = _mm_loadu_pd(wave + i + 1);
+            _mm_storeu_pd(wave + i, _mm_mul_pd(factor, _mm_mul_pd(_mm_add_pd(here, next), half)));
+
+            __m128d mixed = accumulate ? _mm_add_pd(_mm_loadu_pd(out + i), here) : here;
+            _mm_storeu_pd(out + i, mixed);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float64x2_t half   = vdupq_n_f64(0.5);
+        const float64x2_t factor = vdupq_n_f64(decay);
+        for (; i + 2 <= n; i += 2) {
+            float64x2_t here = vld1q_f64(wave + i);
+            float64x2_t next = vld1q_f64(wave + i + 1);
+            vst1q_f64(wave + i, vmulq_f64(factor, vmulq_f64(vaddq_f64(here, next), half)));
+
+            float64x2_t mixed = accumulate ? vaddq_f64(vld1q_f64(out + i), here) : here;
+            vst1q_f64(out + i, mixed);
+        }
+#endif
+
+        advanceScalar(wave + i, out + i, n - i, decay, accumulate);
+    }
+
+    void advance(float* wave, float* out, int n, float decay, bool accumulate) {
+        int i = 0;
+
+#if defined(__AVX__)
+        const __m256 half   = _mm256_set1_ps(0.5f);
+        const __m256 factor = _mm256_set1_ps(decay);
+        for (; i + 8 <= n; i += 8) {
+            __m256 here = _mm256_loadu_ps(wave + i);
+            __m256 next = _mm256_loadu_ps(wave + i + 1);
+            _mm256_storeu_ps(wave + i, _mm256_mul_ps(factor, _mm256_mul_ps(_mm256_add_ps(here, next), half)));
+
+            __m256 mixed = accumulate ? _mm256_add_ps(_mm256_loadu_ps(out + i), here) : here;
+            _mm256_storeu_ps(out + i, mixed);
+        }
+#elif defined(__SSE2__)
+        const __m128 half   = _mm_set1_ps(0.5f);
+        const __m128 factor = _mm_set1_ps(decay);
+        for (; i + 4 <= n; i += 4) {
+            __m128 here = _mm_loadu_ps(wave + i);
+            __m128 next = _mm_loadu_ps(wave + i + 1);
+            _mm_storeu_ps(wave + i, _mm_mul_ps(factor, _mm_mul_ps(_mm_add_ps(here, next), half)));
+
+            __m128 mixed = accumulate ? _mm_add_ps(_mm_loadu_ps(out + i), here) : here;
+            _mm_storeu_ps(out + i, mixed);
+        }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        const float32x4_t half   = vdupq_n_f32(0.5f);
+        const float32x4_t factor = vdupq_n_f32(decay);
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t here = vld1q_f32(wave + i);
+            float32x4_t next = vld1q_f32(wave + i + 1);
+            vst1q_f32(wave + i, vmulq_f32(factor, vmulq_f32(vaddq_f32(here, next), half)));
+
+            float32x4_t mixed = accumulate ? vaddq_f32(vld1q_f32(out + i), here) : here;
+            vst1q_f32(out + i, mixed);
+        }
+#endif
+
+        advanceScalar(wave + i, out + i, n - i, decay, accumulate);
+    }
+
+    void render(double* wave, int length, int& cursor, double* out, int n, double decay, bool accumulate) {
+        renderRuns<double>(wave, length, cursor, out, n, decay, nullptr, accumulate);
+    }
+
+    void render(double* wave, int length, int& cursor, double* out, int n, double decay,
+                Allpass<double>& allpass, bool accumulate) {
+        renderRuns(wave, length, cursor, out, n, decay, &allpass, accumulate);
+    }
+
+    void render(float* wave, int length, int& cursor, float* out, int n, float decay, bool accumulate) {
+        renderRuns<float>(wave, length, cursor, out, n, decay, nullptr, accumulate);
+    }
+
+    void render(float* wave, int length, int& cursor, float* out, int n, float decay,
+                Allpass<float>& allpass, bool accumulate) {
+        renderRuns(wave, length, cursor, out, n, decay, &allpass, accumulate);
+    }
+}
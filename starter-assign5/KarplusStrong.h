@@ -0,0 +1,70 @@
+/* File: KarplusStrong.h
+ *
+ * The inner loop of the Karplus-Strong plucked string simulation, shared by
+ * everything that synthesizes strings. It works on raw arrays of doubles so
+ * that it can be vectorized.
+ *
+ * There are also single-precision versions of each function. They do the
+ * same arithmetic in floats, which fit twice as many samples into each
+ * vector instruction and each cache line.
+ *
+ * A string's pitch is set by how long a sample takes to make it around the
+ * loop. With a waveform of length n, that's n - 1/2 samples: n slots, less
+ * the half a sample the averaging gives back. Strings whose period isn't a
+ * whole number plus a half can put an allpass filter in the loop to make up
+ * the difference.
+ */
+#pragma once
+
+namespace KarplusStrong {
+    /* A first-order allpass filter, which delays low frequencies by a
+     * fraction of a sample without changing how loud anything is. The
+     * coefficient sets the delay; lastIn and lastOut are its memory.
+     */
+    template <typename T> struct Allpass {
+        T coefficient = 0;
+        T lastIn = 0;
+        T lastOut = 0;
+    };
+
+    /* Returns the allpass coefficient that delays low frequencies by the
+     * given number of samples, which should be between 0.5 and 1.5 for the
+     * filter to be well behaved.
+     */
+    double allpassCoefficient(double delay);
+
+    /* Advances a run of n slots of a string's waveform, starting at wave[0].
+     * Each slot is output and then replaced by decay times the average of
+     * itself and the slot to its right, exactly as StringInstrument::nextSample()
+     * does one sample at a time.
+     *
+     * Because each slot reads its right-hand neighbour, wave[n] must exist and
+     * the run must not cross the point where the waveform wraps around. It is
+     * the caller's job to split the work up at that point.
+     *
+     * If accumulate is true, the outputs are added into out; otherwise they
+     * overwrite it.
+     */
+    void advance(double* wave, double* out, int n, double decay, bool accumulate);
+
+    /* Produces the next n samples from a string whose waveform has the given
+     * length and whose cursor is at the given position, splitting the work at
+     * the wraparound point and moving the cursor forward. This is the block
+     * version of StringInstrument::nextSample().
+     */
+    void render(double* wave, int length, int& cursor, double* out, int n, double decay, bool accumulate);
+
+    /* Same as render(), except that each slot passes through the given
+     * allpass filter on its way back into the waveform. The averaging is
+     * still done several slots at a time; the filter follows it over each
+     * run while the run is still in cache.
+     */
+    void render(double* wave, int length, int& cursor, double* out, int n, double decay,
+                Allpass<double>& allpass, bool accumulate);
+
+    /* Single-precision versions of the above. */
+    void advance(float* wave, float* out, int n, float decay, bool accumulate);
+    void render(float* wave, int length, int& cursor, float* out, int n, float decay, bool accumulate);
+    void render(float* wave, int length, int& cursor, float* out, int n, float decay,
+                Allpass<float>& allpass, bool accumulate);
+}
@@ -0,0 +1,415 @@
+/* File: ParallelRenderer.cpp
+ *
+ * Implementation of the ParallelRenderer type.
+ *
+ * Each call to render() publishes a job by bumping the generation in _job.
+ * The workers and the calling thread then race to claim partitions from it,
+ * and the calling thread waits for the stragglers before mixing the
+ * partitions together. Nobody ever takes a lock on the rendering path: the
+ * workers only use _mutex to sleep when there's nothing to do.
+ */
+#include "ParallelRenderer.h"
+#include "error.h"
+#include <algorithm>
+#include <chrono>
+#ifdef __linux__
+#include <pthread.h>
+#endif
+using namespace std;
+
+namespace {
+    /* Fewer strings than this per partition isn't worth a thread. */
+    const int kVoicesPerPartition = 32;
+    const int kMaxPartitions      = 16;
+
+    /* Spans shorter than this are rendered on the calling thread, since
+     * they'd be done before the workers even woke up.
+     */
+    const int kMinThreadedFrames = 256;
+
+    /* Partitions are rendered this many frames at a time. After a missed
+     * deadline, the calling thread waits for at most one chunk per partition.
+     */
+    const int kChunkFrames = 128;
+
+    /* How many blocks to render without the workers after missing a deadline. */
+    const int kBackoffBlocks = 64;
+
+    const double kDefaultDeadline = 0.001;
+
+    /* Layout of the _job word. */
+    uint64_t packJob(uint32_t generation, int partitions, int next) {
+        return uint64_t(generation) << 32 | uint64_t(partitions) << 16 | uint64_t(next);
+    }
+    uint32_t generationOf(uint64_t job) {
+        return uint32_t(job >> 32);
+    }
+    int partitionsOf(uint64_t job) {
+        return int((job >> 16) & 0xFFFF);
+    }
+    int nextOf(uint64_t job) {
+        return int(job & 0xFFFF);
+    }
+
+    /* Layout of a _progress word. The generation sits in the same place as in
+     * the _job word, so generationOf() works on both.
+     */
+    const uint64_t kBusy = 1;
+    uint64_t packProgress(uint32_t generation, int next, int chunks) {
+        return uint64_t(generation) << 32 | uint64_t(chunks) << 16 | uint64_t(next) << 1;
+    }
+    int chunksOf(uint64_t progress) {
+        return int((progress >> 16) & 0xFFFF);
+    }
+    int nextChunkOf(uint64_t progress) {
+        return int((progress >> 1) & 0x7FFF);
+    }
+
+    /* Keeps a worker on one core so that its strings stay in that core's
+     * cache. This is only a hint, so it's fine if it doesn't work.
+     */
+    void pinToCore(thread& worker, int core) {
+#ifdef __linux__
+        cpu_set_t cores;
+        CPU_ZERO(&cores);
+        CPU_SET(core, &cores);
+        pthread_setaffinity_np(worker.native_handle(), sizeof(cores), &cores);
+#else
+        (void) worker;
+        (void) core;
+#endif
+    }
+}
+
+/* render() passes this to std::min(), which binds a reference to it. */
+const int ParallelRenderer::kMaxFrames;
+
+ParallelRenderer::ParallelRenderer(int workers) {
+    if (workers < 0) {
+        error("Number of worker threads cannot be negative.");
+    }
+    _maxWorkers = min(workers, kMaxPartitions - 1);
+
+    _scratch = new double[(kMaxPartitions - 1) * kMaxFrames];
+    _progress = new atomic<uint64_t>[kMaxPartitions];
+    for (int partition = 0; partition < kMaxPartitions; partition++) {
+        _progress[partition].store(0);
+    }
+    setDeadline(kDefaultDeadline);
+}
+
+ParallelRenderer::~ParallelRenderer() {
+    _stopping.store(true);
+    {
+        /* Taking the lock here makes sure no worker is between checking
+         * _stopping and going to sleep.
+         */
+        lock_guard<mutex> lock(_mutex);
+    }
+    _wake.notify_all();
+    for (thread& worker: _workers) {
+        worker.join();
+    }
+    delete[] _scratch;
+    delete[] _progress;
+}
+
+/* Worker i goes on core i + 1, leaving core 0 to the audio thread. */
+void ParallelRenderer::startWorkers() {
+    if (!_workers.empty()) return;
+
+    int cores = max(1, int(thread::hardware_concurrency()));
+    for (int i = 0; i < _maxWorkers; i++) {
+        _workers.emplace_back(&ParallelRenderer::workerLoop, this);
+        pinToCore(_workers.back(), (i + 1) % cores);
+    }
+    _running.store(int(_workers.size()), memory_order_release);
+}
+
+int ParallelRenderer::defaultWorkerCount() {
+    int cores = int(thread::hardware_concurrency());
+    return max(0, min(cores - 1, kMaxPartitions - 1));
+}
+
+int ParallelRenderer::partitionsFor(int voices) {
+    return max(1, min(kMaxPartitions, voices / kVoicesPerPartition));
+}
+
+void ParallelRenderer::setDeadline(double seconds) {
+    if (seconds < 0) {
+        error("Deadline cannot be negative.");
+    }
+    _deadlineNanos.store(int64_t(seconds * 1e9));
+}
+
+int64_t ParallelRenderer::missedDeadlines() const {
+    return _missed.load();
+}
+
+int ParallelRenderer::workerCount() const {
+    return _running.load(memory_order_acquire);
+}
+
+/* Renders every partition of one block of at most kMaxFrames frames, using
+ * the current job's bank, leaving the mixing to the caller.
+ *
+ * Each block gets a new generation, so a worker still looking at the last
+ * block can't take a chunk of this one by mistake.
+ */
+void ParallelRenderer::renderPartitions(void* out, int frames) {
+    _out = out;
+    _frames = frames;
+    _generation++;
+    int chunks = (frames + kChunkFrames - 1) / kChunkFrames;
+    for (int partition = 0; partition < _partitions; partition++) {
+        _progress[partition].store(packProgress(_generation, 0, chunks), memory_order_release);
+    }
+
+    bool threaded = _running.load(memory_order_acquire) > 0 && frames >= kMinThreadedFrames;
+    if (!threaded || _backoff > 0) {
+        if (threaded) _backoff--;
+        for (int partition = 0; partition < _partitions; partition++) {
+            finishPartition(partition, _generation);
+        }
+        return;
+    }
+
+    /* Hand out the job, then pitch in until every partition is taken. */
+    _job.store(packJob(_generation, _partitions, 0), memory_order_release);
+    _wake.notify_all();
+
+    int partition;
+    while (claim(_generation, partition)) {
+        finishPartition(partition, _generation);
+    }
+
+    /* Wait for the workers to finish whatever they took, and past the
+     * deadline, take over whatever they haven't got to yet.
+     */
+    auto start = chrono::steady_clock::now();
+    chrono::nanoseconds deadline(_deadlineNanos.load(memory_order_relaxed));
+    while (!isFinished()) {
+        if (chrono::steady_clock::now() - start > deadline) {
+            _missed.fetch_add(1, memory_order_relaxed);
+            _backoff = kBackoffBlocks;
+            for (int partition = 0; partition < _partitions; partition++) {
+                finishPartition(partition, _generation);
+            }
+            return;
+        }
+        this_thread::yield();
+    }
+}
+
+/* Tries to take the next partition of the job with the given generation.
+ * Returns false if that job is over or every partition is already taken.
+ */
+bool ParallelRenderer::claim(uint32_t generation, int& partition) {
+    uint64_t job = _job.load(memory_order_acquire);
+    while (generationOf(job) == generation && nextOf(job) < partitionsOf(job)) {
+        if (_job.compare_exchange_weak(job, job + 1, memory_order_acq_rel, memory_order_acquire)) {
+            partition = nextOf(job);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Renders the next chunk of a partition of the job with the given generation.
+ * Returns false, without doing anything, if that job is over, the partition
+ * is finished, or another thread is partway through a chunk of it.
+ */
+bool ParallelRenderer::renderChunk(int partition, uint32_t generation) {
+    uint64_t progress = _progress[partition].load(memory_order_acquire);
+    if (generationOf(progress) != generation || (progress & kBusy) ||
+        nextChunkOf(progress) == chunksOf(progress)) {
+        return false;
+    }
+    if (!_progress[partition].compare_exchange_strong(progress, progress | kBusy,
+                                                      memory_order_acq_rel, memory_order_acquire)) {
+        return false;
+    }
+
+    int begin = int(int64_t(_voices) * partition / _partitions);
+    int end   = int(int64_t(_voices) * (partition + 1) / _partitions);
+    int first = nextChunkOf(progress) * kChunkFrames;
+    int frames = min(kChunkFrames, _frames - first);
+
+    char* out = static_cast<char*>(target(partition)) + first * _valueSize;
+    _renderVoices(_bank, out, frames, begin, end);
+
+    _progress[partition].store(progress + 2, memory_order_release);
+    return true;
+}
+
+/* Renders whatever is left of a partition, waiting on any chunk another
+ * thread is in the middle of.
+ */
+void ParallelRenderer::finishPartition(int partition, uint32_t generation) {
+    while (true) {
+        uint64_t progress = _progress[partition].load(memory_order_acquire);
+        if (nextChunkOf(progress) == chunksOf(progress)) return;
+        if (!renderChunk(partition, generation)) {
+            this_thread::yield();
+        }
+    }
+}
+
+bool ParallelRenderer::isFinished() const {
+    for (int partition = 0; partition < _partitions; partition++) {
+        uint64_t progress = _progress[partition].load(memory_order_acquire);
+        if (nextChunkOf(progress) != chunksOf(progress)) return false;
+    }
+    return true;
+}
+
+void* ParallelRenderer::target(int partition) const {
+    return partition == 0 ? _out : _scratch + (partition - 1) * kMaxFrames;
+}
+
+/* Idle workers wait for a new job without a timeout. The rendering thread
+ * doesn't take _mutex before waking them, so a worker can miss a wakeup and
+ * sleep through a job, but nothing is lost: the rendering thread claims any
+ * partitions the workers don't get to, and the next job wakes the worker up.
+ */
+void ParallelRenderer::workerLoop() {
+    uint32_t seen = 0;
+    while (!_stopping.load()) {
+        uint32_t generation = generationOf(_job.load(memory_order_acquire));
+        if (generation == seen) {
+            unique_lock<mutex> lock(_mutex);
+            _wake.wait(lock, [&] {
+                return _stopping.load() || generationOf(_job.load(memory_order_acquire)) != seen;
+            });
+            continue;
+        }
+
+        seen = generation;
+        int partition;
+        while (claim(seen, partition)) {
+            while (renderChunk(partition, seen)) {}
+        }
+    }
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include "StringBank.h"
+#include "Demos/AudioSystem.h"
+#include <cmath>
+
+namespace {
+    /* Makes a bank of count strings and plucks all of them. */
+    void pluckedBank(StringBank& bank, int count) {
+        for (int i = 0; i < count; i++) {
+            bank.add(110 + 3 * i);
+            bank.pluck(i);
+        }
+    }
+}
+
+STUDENT_TEST("ParallelRenderer output doesn't depend on how many threads there are.") {
+    AudioSystem::setSampleRate(44100);
+
+    const int kVoices = 300;
+    const int kFrames = 3000;
+    EXPECT_EQUAL(ParallelRenderer::partitionsFor(kVoices), 9);
+
+    StringBank serial, alone, threaded;
+    pluckedBank(serial, kVoices);
+    pluckedBank(alone, kVoices);
+    pluckedBank(threaded, kVoices);
+
+    ParallelRenderer noWorkers(0);
+    ParallelRenderer workers(3);
+    EXPECT_EQUAL(workers.workerCount(), 0);
+    workers.startWorkers();
+    workers.startWorkers();
+    EXPECT_EQUAL(workers.workerCount(), 3);
+
+    vector<double> expected(kFrames), byCaller(kFrames), byWorkers(kFrames);
+    for (int pass = 0; pass < 5; pass++) {
+        serial.render(expected.data(), kFrames);
+        alone.render(byCaller.data(), kFrames, &noWorkers);
+        threaded.render(byWorkers.data(), kFrames, &workers);
+
+        /* Same partitions, so exactly the same sums. */
+        EXPECT(byCaller == byWorkers);
+
+        /* Different order of addition than serial, so close but not exact. */
+        for (int i = 0; i < kFrames; i++) {
+            EXPECT(fabs(byWorkers[i] - expected[i]) < 1e-12);
+        }
+    }
+
+    for (int i = 0; i < kVoices; i++) {
+        EXPECT_EQUAL(threaded.cursor(i), serial.cursor(i));
+    }
+}
+
+STUDENT_TEST("ParallelRenderer renders small banks serially.") {
+    AudioSystem::setSampleRate(44100);
+
+    EXPECT_EQUAL(ParallelRenderer::partitionsFor(0), 1);
+    EXPECT_EQUAL(ParallelRenderer::partitionsFor(63), 1);
+    EXPECT_EQUAL(ParallelRenderer::partitionsFor(64), 2);
+    EXPECT_EQUAL(ParallelRenderer::partitionsFor(5000), 16);
+    EXPECT_ERROR(ParallelRenderer(-1));
+
+    StringBank serial, parallel;
+    pluckedBank(serial, 40);
+    pluckedBank(parallel, 40);
+
+    ParallelRenderer workers(2);
+    double expected[500], block[500];
+    for (int pass = 0; pass < 10; pass++) {
+        serial.render(expected, 500);
+        parallel.render(block, 500, &workers);
+        for (int i = 0; i < 500; i++) {
+            EXPECT_EQUAL(block[i], expected[i]);
+        }
+    }
+}
+
+STUDENT_TEST("ParallelRenderer takes over from late workers and keeps short spans to itself.") {
+    AudioSystem::setSampleRate(44100);
+
+    const int kVoices = 200;
+    StringBank alone, hurried, reference, chopped;
+    pluckedBank(alone, kVoices);
+    pluckedBank(hurried, kVoices);
+    pluckedBank(reference, kVoices);
+    pluckedBank(chopped, kVoices);
+
+    /* With no time at all to spare, every block misses its deadline, and the
+     * calling thread finishes whatever the workers haven't. The sums come out
+     * the same regardless.
+     */
+    ParallelRenderer noWorkers(0);
+    ParallelRenderer impatient(3);
+    impatient.startWorkers();
+    impatient.setDeadline(0);
+
+    vector<double> expected(2000), block(2000);
+    for (int pass = 0; pass < 5; pass++) {
+        alone.render(expected.data(), 2000, &noWorkers);
+        hurried.render(block.data(), 2000, &impatient);
+        EXPECT(block == expected);
+    }
+
+    /* One frame at a time never wakes the workers, but still renders in the
+     * same partitions.
+     */
+    ParallelRenderer workers(3);
+    workers.startWorkers();
+    for (int pass = 0; pass < 5; pass++) {
+        reference.render(expected.data(), 2000, &noWorkers);
+        for (int i = 0; i < 2000; i++) {
+            chopped.render(&block[i], 1, &workers);
+        }
+        for (int i = 0; i < 2000; i++) {
+            EXPECT_EQUAL(block[i], expected[i]);
+        }
+    }
+    EXPECT_EQUAL(generationOf(workers._job.load()), 0);
+}
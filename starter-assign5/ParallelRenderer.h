@@ -0,0 +1,193 @@
+/* File: ParallelRenderer.h
+ *
+ * Spreads the work of rendering a StringBank over several threads. The awake
+ * strings are split into partitions, each partition is rendered into a block
+ * buffer of its own, and the buffers are added together in a fixed order.
+ *
+ * How the strings are split up depends only on how many of them are awake,
+ * never on how many threads there are or which thread rendered what, so the
+ * output is exactly the same from one run to the next. It can differ from
+ * StringBank's own serial render in the last few bits, since the sums are
+ * done in a different order.
+ *
+ * Banks with only a few strings awake aren't worth splitting up, and are
+ * rendered serially on the calling thread. So are short stretches of audio,
+ * which would be over before the workers woke up; those still use the same
+ * partitions, so the output doesn't change.
+ */
+#pragma once
+
+#include "GUI/SimpleTest.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ParallelRenderer {
+public:
+    /* Sets up for the given number of worker threads, which don't start
+     * until startWorkers() is called. The thread that calls render() always
+     * does some of the work too, so the default leaves one core for it. With
+     * no workers running, everything happens on the calling thread, in the
+     * same partitions.
+     */
+    explicit ParallelRenderer(int workers = defaultWorkerCount());
+
+    /* Starts the worker threads, if they aren't running already. Call it once
+     * banks big enough to split up are on the way, from any thread but the
+     * one calling render(), since starting threads can take a while. It's
+     * safe to call while render() runs on another thread.
+     */
+    void startWorkers();
+
+    /* Stops and joins the worker threads. */
+    ~ParallelRenderer();
+
+    /* One worker for every core but one. */
+    static int defaultWorkerCount();
+
+    /* How many partitions a bank with the given number of awake strings is
+     * split into. A result of 1 means the bank is rendered serially.
+     */
+    static int partitionsFor(int voices);
+
+    /* Generates the next frames samples from every awake string in the bank
+     * and writes their sum into out. The bank's clock isn't moved forward, so
+     * this is meant to be called from StringBank::render(). Works with both
+     * StringBank and FloatStringBank.
+     */
+    template <typename Bank> void render(Bank& bank, typename Bank::Value* out, int frames);
+
+    /* How long render() waits for the workers before giving up on them.
+     * Partitions are rendered a short chunk at a time, so once the deadline
+     * passes, the calling thread only waits for the chunks the workers are
+     * in the middle of and renders the rest itself. It then renders
+     * everything by itself for a little while, so a worker that got
+     * descheduled can't keep making the audio late. The default is one
+     * millisecond.
+     */
+    void setDeadline(double seconds);
+
+    /* How many times render() has had to wait past the deadline. */
+    int64_t missedDeadlines() const;
+
+    /* How many worker threads are running. */
+    int workerCount() const;
+
+    /* Not copyable; the worker threads point back at this object. */
+    ParallelRenderer(const ParallelRenderer&) = delete;
+    void operator= (const ParallelRenderer&) = delete;
+
+private:
+    /* Longer renders are done this many frames at a time. */
+    static const int kMaxFrames = 1024;
+
+    /* Job being worked on. Everything here is written by the rendering thread
+     * before the job is published through _job, and only read afterward. The
+     * bank's type is erased so that the workers don't need to know it;
+     * _renderVoices knows how to call renderVoices() on it.
+     */
+    void* _bank = nullptr;
+    void (*_renderVoices)(void* bank, void* out, int frames, int begin, int end) = nullptr;
+    void* _out = nullptr;
+    int _valueSize = 0;   // Bytes in each of the bank's samples
+    int _frames = 0;
+    int _voices = 0;
+    int _partitions = 0;
+
+    /* The job's generation, partition count, and next unclaimed partition,
+     * packed into one word so that a partition can be claimed with a single
+     * compare-and-swap.
+     */
+    std::atomic<uint64_t> _job{0};
+    uint32_t _generation = 0;
+
+    /* How far along each partition is: the job's generation, its next chunk
+     * and number of chunks, and whether a thread is rendering a chunk of it
+     * right now, packed into one word per partition. Whoever claimed the
+     * partition renders its chunks, but after a missed deadline the calling
+     * thread can take over between chunks.
+     */
+    std::atomic<uint64_t>* _progress = nullptr;
+
+    /* Private block buffers for every partition but the first, which renders
+     * straight into the output. Each one has room for kMaxFrames doubles, or
+     * the same number of floats.
+     */
+    double* _scratch = nullptr;
+
+    std::atomic<int64_t> _deadlineNanos;
+    std::atomic<int64_t> _missed{0};
+    int _backoff = 0;   // Blocks left to render without the workers
+
+    /* Idle workers sleep here. Only startWorkers() and the destructor touch
+     * _workers; render() just looks at _running.
+     */
+    int _maxWorkers;
+    std::vector<std::thread> _workers;
+    std::atomic<int> _running{0};
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::atomic<bool> _stopping{false};
+
+    void renderPartitions(void* out, int frames);
+    template <typename Value> void mixPartitions(int frames);
+    bool claim(uint32_t generation, int& partition);
+    bool renderChunk(int partition, uint32_t generation);
+    void finishPartition(int partition, uint32_t generation);
+    bool isFinished() const;
+    void* target(int partition) const;
+    void workerLoop();
+
+    ALLOW_TEST_ACCESS();
+};
+
+/* * * * * Implementation Below This Point * * * * */
+
+template <typename Bank>
+void ParallelRenderer::render(Bank& bank, typename Bank::Value* out, int frames) {
+    using Value = typename Bank::Value;
+    static_assert(sizeof(Value) <= sizeof(double), "Partition buffers are sized for doubles.");
+
+    int voices = bank.activeCount();
+    int partitions = partitionsFor(voices);
+    if (partitions == 1) {
+        bank.renderVoices(out, frames, 0, voices);
+        return;
+    }
+
+    _bank = &bank;
+    _renderVoices = [](void* bank, void* out, int frames, int begin, int end) {
+        static_cast<Bank*>(bank)->renderVoices(static_cast<Value*>(out), frames, begin, end);
+    };
+    _valueSize = sizeof(Value);
+    _voices = voices;
+    _partitions = partitions;
+
+    while (frames > 0) {
+        int span = std::min(frames, kMaxFrames);
+        renderPartitions(out, span);
+        mixPartitions<Value>(span);
+        out += span;
+        frames -= span;
+    }
+}
+
+/* Mixes the partitions pairwise, always in the same order, so partition 0
+ * (the output) ends up holding the sum of all of them.
+ */
+template <typename Value>
+void ParallelRenderer::mixPartitions(int frames) {
+    for (int stride = 1; stride < _partitions; stride *= 2) {
+        for (int p = 0; p + stride < _partitions; p += 2 * stride) {
+            Value* into = static_cast<Value*>(target(p));
+            const Value* from = static_cast<const Value*>(target(p + stride));
+            for (int i = 0; i < frames; i++) {
+                into[i] += from[i];
+            }
+        }
+    }
+}
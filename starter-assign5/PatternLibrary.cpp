@@ -0,0 +1,406 @@
+/* File: PatternLibrary.cpp
+ *
+ * Implementation of the PatternLibrary, PatternView, and PatternWriter types.
+ *
+ * The structs in PatternLibrary.h are laid over the mapped file directly, so
+ * their sizes are pinned down here, and every offset is checked for alignment
+ * and bounds before anything is read through it.
+ */
+#include "PatternLibrary.h"
+#include "error.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+using namespace std;
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define PATTERN_LIBRARY_MMAP
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace PatternFormat;
+
+static_assert(sizeof(Header)     == 32, "Pattern library header must be 32 bytes.");
+static_assert(sizeof(IndexEntry) == 16, "Pattern library index entries must be 16 bytes.");
+static_assert(sizeof(Record)     == 48, "Pattern library records must start with 48 bytes.");
+
+namespace {
+    /* Far bigger than any grid anyone draws, and small enough that the size
+     * of a pattern can't overflow.
+     */
+    const int kMaxPatternSize = 1 << 16;
+
+    /* Bytes taken up by a pattern's record with the given number of notes
+     * and rows.
+     */
+    uint64_t recordBytes(uint64_t noteCount, uint64_t size) {
+        return sizeof(Record) + sizeof(double) * noteCount +
+               sizeof(uint64_t) * size * wordsPerColumn(int(size));
+    }
+}
+
+PatternView::PatternView(const Record* record, int size) {
+    _record  = record;
+    _size    = size;
+    _cents   = reinterpret_cast<const double*>(record + 1);
+    _columns = reinterpret_cast<const uint64_t*>(_cents + record->noteCount);
+}
+
+int PatternView::size() const {
+    return _size;
+}
+
+Tempo PatternView::tempo() const {
+    Tempo result;
+    result.bpm          = _record->bpm;
+    result.stepsPerBeat = _record->stepsPerBeat;
+    result.stepSamples  = _record->stepSamples;
+    result.swing        = _record->swing;
+    return result;
+}
+
+Scale PatternView::scale() const {
+    vector<double> cents(_cents, _cents + _record->noteCount);
+    return Scale(_record->baseFrequency, cents, _record->periodCents);
+}
+
+bool PatternView::isOn(int row, int col) const {
+    if (row < 0 || row >= _size || col < 0 || col >= _size) {
+        error("Position (" + to_string(row) + ", " + to_string(col) + ") isn't in the pattern.");
+    }
+    uint64_t word = _columns[wordsPerColumn() * col + row / 64];
+    return (word >> (row % 64)) & 1;
+}
+
+const uint64_t* PatternView::columns() const {
+    return _columns;
+}
+
+int PatternView::wordsPerColumn() const {
+    return PatternFormat::wordsPerColumn(_size);
+}
+
+PatternLibrary::PatternLibrary(const string& filename) {
+#ifdef PATTERN_LIBRARY_MMAP
+    int file = open(filename.c_str(), O_RDONLY);
+    if (file < 0) {
+        error("Cannot open pattern library " + filename + ".");
+    }
+    struct stat info;
+    if (fstat(file, &info) != 0 || size_t(info.st_size) < sizeof(Header)) {
+        close(file);
+        error(filename + " is not a pattern library.");
+    }
+    _bytes = size_t(info.st_size);
+    void* mapping = mmap(nullptr, _bytes, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) {
+        error("Cannot map pattern library " + filename + ".");
+    }
+    _mapping = mapping;
+    _data = static_cast<const unsigned char*>(mapping);
+#else
+    ifstream input(filename, ios::binary | ios::ate);
+    if (!input) {
+        error("Cannot open pattern library " + filename + ".");
+    }
+    _bytes = size_t(input.tellg());
+    _copy.resize((_bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+    input.seekg(0);
+    input.read(reinterpret_cast<char*>(_copy.data()), _bytes);
+    _data = reinterpret_cast<const unsigned char*>(_copy.data());
+#endif
+
+    /* Only the header and the index are checked up front. Each pattern is
+     * checked when it's asked for, so opening a big library stays quick.
+     */
+    const Header* header = reinterpret_cast<const Header*>(_data);
+    bool valid = _bytes >= sizeof(Header) &&
+                 memcmp(header->magic, kMagic, sizeof(kMagic)) == 0 &&
+                 header->byteOrder == kByteOrder &&
+                 header->indexOffset % 8 == 0 &&
+                 header->indexOffset <= _bytes &&
+                 header->count <= (_bytes - header->indexOffset) / sizeof(IndexEntry);
+    if (!valid) {
+        unmap();
+        error(filename + " is not a pattern library.");
+    }
+    if (header->version != kVersion) {
+        unmap();
+        error(filename + " is a pattern library from a different version of the Tone Matrix.");
+    }
+
+    _index = reinterpret_cast<const IndexEntry*>(_data + header->indexOffset);
+    _count = int(header->count);
+}
+
+PatternLibrary::~PatternLibrary() {
+    unmap();
+}
+
+/* The constructor calls this too if the file turns out to be no good, since
+ * the destructor won't run if the constructor doesn't finish.
+ */
+void PatternLibrary::unmap() {
+#ifdef PATTERN_LIBRARY_MMAP
+    if (_mapping != nullptr) {
+        munmap(_mapping, _bytes);
+        _mapping = nullptr;
+    }
+#endif
+}
+
+int PatternLibrary::size() const {
+    return _count;
+}
+
+PatternView PatternLibrary::pattern(int index) const {
+    if (index < 0 || index >= _count) {
+        error("Pattern " + to_string(index) + " isn't in the library.");
+    }
+
+    const IndexEntry& entry = _index[index];
+    bool valid = entry.offset % 8 == 0 &&
+                 entry.size > 0 && entry.size <= uint32_t(kMaxPatternSize) &&
+                 entry.offset <= _bytes && _bytes - entry.offset >= sizeof(Record);
+    if (!valid) {
+        error("Pattern " + to_string(index) + " in the library is damaged.");
+    }
+
+    const Record* record = reinterpret_cast<const Record*>(_data + entry.offset);
+    if (record->noteCount > _bytes / sizeof(double) ||
+        recordBytes(record->noteCount, entry.size) > _bytes - entry.offset) {
+        error("Pattern " + to_string(index) + " in the library is damaged.");
+    }
+
+    /* The audio thread walks the words as they are, so a light past the last
+     * row would land outside its grid.
+     */
+    PatternView view(record, int(entry.size));
+    if (entry.size % 64 != 0) {
+        int words = view.wordsPerColumn();
+        uint64_t padding = ~uint64_t(0) << (entry.size % 64);
+        for (int col = 0; col < view.size(); col++) {
+            if (view.columns()[words * col + words - 1] & padding) {
+                error("Pattern " + to_string(index) + " in the library is damaged.");
+            }
+        }
+    }
+    return view;
+}
+
+/* Only whole pages inside the record are dropped, so the neighbouring
+ * patterns that share its first and last pages aren't disturbed.
+ */
+void PatternLibrary::release(int index) const {
+    PatternView view = pattern(index);
+#ifdef PATTERN_LIBRARY_MMAP
+    uintptr_t page  = uintptr_t(sysconf(_SC_PAGESIZE));
+    uintptr_t start = reinterpret_cast<uintptr_t>(_data) + _index[index].offset;
+    uintptr_t end   = start + recordBytes(view._record->noteCount, uint64_t(view.size()));
+    start = (start + page - 1) / page * page;
+    end   = end / page * page;
+    if (start < end) {
+        madvise(reinterpret_cast<void*>(start), end - start, MADV_DONTNEED);
+    }
+#else
+    (void) view;
+#endif
+}
+
+int PatternWriter::add(int size, const Tempo& tempo, const Scale& scale) {
+    if (size <= 0 || size > kMaxPatternSize) {
+        error("Pattern size must be between 1 and " + to_string(kMaxPatternSize) + ".");
+    }
+    checkTempo(tempo);
+
+    Pattern pattern = { size, tempo, scale, vector<uint64_t>(size_t(size) * wordsPerColumn(size), 0) };
+    _patterns.push_back(pattern);
+    return int(_patterns.size()) - 1;
+}
+
+void PatternWriter::setLight(int index, int row, int col, bool on) {
+    if (index < 0 || index >= size()) {
+        error("Pattern " + to_string(index) + " hasn't been added.");
+    }
+    Pattern& pattern = _patterns[index];
+    if (row < 0 || row >= pattern.size || col < 0 || col >= pattern.size) {
+        error("Position (" + to_string(row) + ", " + to_string(col) + ") isn't in the pattern.");
+    }
+
+    uint64_t& word = pattern.columns[wordsPerColumn(pattern.size) * col + row / 64];
+    uint64_t bit = uint64_t(1) << (row % 64);
+    word = on? word | bit : word & ~bit;
+}
+
+int PatternWriter::size() const {
+    return int(_patterns.size());
+}
+
+void PatternWriter::save(const string& filename) const {
+    ofstream output(filename, ios::binary);
+    if (!output) {
+        error("Cannot create pattern library " + filename + ".");
+    }
+
+    /* Everything is a multiple of eight bytes long, so laying records end to
+     * end keeps them all aligned.
+     */
+    Header header = {};
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version     = kVersion;
+    header.count       = uint32_t(_patterns.size());
+    header.byteOrder   = kByteOrder;
+    header.indexOffset = sizeof(Header);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    uint64_t offset = sizeof(Header) + sizeof(IndexEntry) * _patterns.size();
+    for (const Pattern& pattern: _patterns) {
+        IndexEntry entry = {};
+        entry.offset = offset;
+        entry.size   = uint32_t(pattern.size);
+        output.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        offset += recordBytes(pattern.scale.cents().size(), pattern.size);
+    }
+
+    for (const Pattern& pattern: _patterns) {
+        Record record = {};
+        record.bpm           = pattern.tempo.bpm;
+        record.stepSamples   = pattern.tempo.stepSamples;
+        record.swing         = pattern.tempo.swing;
+        record.stepsPerBeat  = pattern.tempo.stepsPerBeat;
+        record.noteCount     = uint32_t(pattern.scale.cents().size());
+        record.baseFrequency = pattern.scale.baseFrequency();
+        record.periodCents   = pattern.scale.periodCents();
+        output.write(reinterpret_cast<const char*>(&record), sizeof(record));
+        output.write(reinterpret_cast<const char*>(pattern.scale.cents().data()),
+                     sizeof(double) * pattern.scale.cents().size());
+        output.write(reinterpret_cast<const char*>(pattern.columns.data()),
+                     sizeof(uint64_t) * pattern.columns.size());
+    }
+
+    if (!output) {
+        error("Cannot write pattern library " + filename + ".");
+    }
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include <cstdio>
+
+namespace {
+    const char kTestFile[] = "PatternLibraryTest.tmpl";
+}
+
+STUDENT_TEST("Pattern libraries read back exactly what was written.") {
+    Tempo swung;
+    swung.bpm = 97;
+    swung.swing = 0.25;
+
+    PatternWriter writer;
+    EXPECT_EQUAL(writer.add(4, Tempo(), Scale::pentatonic()), 0);
+    EXPECT_EQUAL(writer.add(70, swung, Scale(440, { 0, -200, -350 }, 700)), 1);
+    writer.setLight(0, 0, 0, true);
+    writer.setLight(0, 3, 2, true);
+    writer.setLight(1, 69, 5, true);
+    writer.setLight(1, 64, 69, true);
+    writer.setLight(1, 1, 1, true);
+    writer.setLight(1, 1, 1, false);
+    EXPECT_ERROR(writer.setLight(0, 4, 0, true));
+    EXPECT_ERROR(writer.setLight(2, 0, 0, true));
+    writer.save(kTestFile);
+
+    {
+        PatternLibrary library(kTestFile);
+        EXPECT_EQUAL(library.size(), 2);
+
+        PatternView first = library.pattern(0);
+        EXPECT_EQUAL(first.size(), 4);
+        EXPECT(first.tempo() == Tempo());
+        EXPECT(first.scale() == Scale::pentatonic());
+        for (int row = 0; row < 4; row++) {
+            for (int col = 0; col < 4; col++) {
+                EXPECT_EQUAL(first.isOn(row, col), (row == 0 && col == 0) || (row == 3 && col == 2));
+            }
+        }
+
+        /* 70 rows take two words a column. */
+        PatternView second = library.pattern(1);
+        EXPECT_EQUAL(second.size(), 70);
+        EXPECT_EQUAL(second.wordsPerColumn(), 2);
+        EXPECT(second.tempo() == swung);
+        EXPECT(second.scale() == Scale(440, { 0, -200, -350 }, 700));
+        EXPECT_EQUAL(second.columns()[2 * 5 + 1], uint64_t(1) << 5);
+        EXPECT_EQUAL(second.columns()[2 * 69 + 1], uint64_t(1));
+        EXPECT(!second.isOn(1, 1));
+
+        /* Views point straight into the file. */
+        EXPECT(reinterpret_cast<const unsigned char*>(second.columns()) > library._data);
+        EXPECT(reinterpret_cast<const unsigned char*>(second.columns()) < library._data + library._bytes);
+        EXPECT_ERROR(library.pattern(2));
+        EXPECT_ERROR(first.isOn(4, 0));
+    }
+    remove(kTestFile);
+}
+
+STUDENT_TEST("Pattern libraries refuse files that aren't libraries or are cut short.") {
+    EXPECT_ERROR(PatternLibrary("NoSuchPatternLibrary.tmpl"));
+
+    {
+        ofstream junk(kTestFile, ios::binary);
+        junk << "This is not a pattern library, just some text that's long enough.";
+    }
+    EXPECT_ERROR(PatternLibrary library(kTestFile));
+
+    /* A library cut off partway through its last pattern still opens, but
+     * that pattern can't be used.
+     */
+    PatternWriter writer;
+    writer.add(8, Tempo(), Scale::pentatonic());
+    writer.add(8, Tempo(), Scale::pentatonic());
+    writer.save(kTestFile);
+
+    string bytes;
+    {
+        ifstream input(kTestFile, ios::binary);
+        bytes.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+    }
+    {
+        ofstream output(kTestFile, ios::binary);
+        output.write(bytes.data(), bytes.size() - 8);
+    }
+    {
+        PatternLibrary library(kTestFile);
+        EXPECT_EQUAL(library.size(), 2);
+        EXPECT_EQUAL(library.pattern(0).size(), 8);
+        EXPECT_ERROR(library.pattern(1));
+    }
+
+    /* Nor can a pattern with lights below its last row. */
+    PatternWriter small;
+    small.add(4, Tempo(), Scale::pentatonic());
+    small.save(kTestFile);
+    {
+        ifstream input(kTestFile, ios::binary);
+        bytes.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+    }
+    {
+        uint64_t column;
+        size_t start = bytes.size() - 4 * sizeof(column);
+        memcpy(&column, bytes.data() + start, sizeof(column));
+        column |= uint64_t(1) << 40;
+        memcpy(&bytes[start], &column, sizeof(column));
+
+        ofstream output(kTestFile, ios::binary);
+        output.write(bytes.data(), bytes.size());
+    }
+    {
+        PatternLibrary library(kTestFile);
+        EXPECT_EQUAL(library.size(), 1);
+        EXPECT_ERROR(library.pattern(0));
+    }
+    remove(kTestFile);
+}
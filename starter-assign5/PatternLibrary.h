@@ -0,0 +1,168 @@
+/* File: PatternLibrary.h
+ *
+ * A file format for storing many Tone Matrix patterns, each with its own
+ * tempo and scale, that can be used straight off the disk. Opening a library
+ * maps the file into memory and checks its header; nothing is parsed, and a
+ * pattern's page of the file isn't even read until the pattern is used. The
+ * lights are stored a bit each, in the same column-by-column layout the audio
+ * thread plays from, so loading a pattern is mostly a matter of copying words.
+ *
+ * The layout of a library file, in little-endian order with everything
+ * aligned to eight bytes:
+ *
+ *    Header        "TMPL", format version, pattern count, byte order marker,
+ *                  offset of the index
+ *    Index         For each pattern, the offset of its record and its size
+ *    Records       For each pattern, its tempo, its scale (base frequency,
+ *                  period, and notes in cents), then its lights: one column
+ *                  after another, with bit r of word w of a column being the
+ *                  light in row 64w + r.
+ *
+ * PatternWriter builds library files.
+ */
+#pragma once
+
+#include "EventScheduler.h"
+#include "Tuning.h"
+#include "GUI/SimpleTest.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace PatternFormat {
+    const char     kMagic[4]   = { 'T', 'M', 'P', 'L' };
+    const uint32_t kVersion    = 1;
+    const uint32_t kByteOrder  = 0x01020304;
+
+    struct Header {
+        char     magic[4];
+        uint32_t version;
+        uint32_t count;
+        uint32_t byteOrder;     // Reads back differently on a big-endian machine
+        uint64_t indexOffset;
+        uint64_t reserved;
+    };
+
+    struct IndexEntry {
+        uint64_t offset;
+        uint32_t size;
+        uint32_t reserved;
+    };
+
+    /* Followed by noteCount doubles of cents, then the lights. */
+    struct Record {
+        double   bpm;
+        double   stepSamples;
+        double   swing;
+        int32_t  stepsPerBeat;
+        uint32_t noteCount;
+        double   baseFrequency;
+        double   periodCents;
+    };
+
+    /* Number of 64-bit words needed to hold one bit for each row. */
+    inline int wordsPerColumn(int rows) {
+        return (rows + 63) / 64;
+    }
+}
+
+/* One pattern in an open PatternLibrary. It points into the library's memory,
+ * so it's cheap to copy, and it's only good for as long as the library is.
+ */
+class PatternView {
+public:
+    /* Number of rows, which is also the number of columns. */
+    int size() const;
+
+    Tempo tempo() const;
+    Scale scale() const;
+
+    /* Whether the light at the given position is on. */
+    bool isOn(int row, int col) const;
+
+    /* The lights, wordsPerColumn() words per column, in the layout above. */
+    const uint64_t* columns() const;
+    int wordsPerColumn() const;
+
+private:
+    friend class PatternLibrary;
+    PatternView(const PatternFormat::Record* record, int size);
+
+    const PatternFormat::Record* _record;
+    const double* _cents;
+    const uint64_t* _columns;
+    int _size;
+};
+
+class PatternLibrary {
+public:
+    /* Opens the library in the given file. Reports an error if the file
+     * can't be read or isn't a pattern library.
+     */
+    explicit PatternLibrary(const std::string& filename);
+
+    /* Unmaps the file. */
+    ~PatternLibrary();
+
+    /* Returns how many patterns are in the library. */
+    int size() const;
+
+    /* Returns the pattern at the given index. Reports an error if the index
+     * is out of range or if that pattern's record runs off the end of the
+     * file.
+     */
+    PatternView pattern(int index) const;
+
+    /* Lets the system take back the memory holding the given pattern, on the
+     * understanding that it won't be needed again soon. Views of it stay
+     * good; its pages are just read from the disk again if they're used.
+     * This does nothing where the library had to be read into memory.
+     */
+    void release(int index) const;
+
+    /* Mapped memory can't be shared between two owners. */
+    PatternLibrary(const PatternLibrary&) = delete;
+    void operator= (const PatternLibrary&) = delete;
+
+private:
+    const unsigned char* _data = nullptr;
+    size_t _bytes = 0;
+
+    /* Where the file is mapped. On systems without mmap(), the file is read
+     * into _copy instead, which is kept in 64-bit words so it's aligned.
+     */
+    void* _mapping = nullptr;
+    std::vector<uint64_t> _copy;
+
+    const PatternFormat::IndexEntry* _index = nullptr;
+    int _count = 0;
+
+    void unmap();
+
+    ALLOW_TEST_ACCESS();
+};
+
+class PatternWriter {
+public:
+    /* Adds a new pattern with every light off and returns its index. */
+    int add(int size, const Tempo& tempo, const Scale& scale);
+
+    /* Turns a light in the given pattern on or off. */
+    void setLight(int index, int row, int col, bool on);
+
+    /* Returns how many patterns have been added. */
+    int size() const;
+
+    /* Writes every pattern added so far into a library file. */
+    void save(const std::string& filename) const;
+
+private:
+    struct Pattern {
+        int size;
+        Tempo tempo;
+        Scale scale;
+        std::vector<uint64_t> columns;
+    };
+    std::vector<Pattern> _patterns;
+};
@@ -0,0 +1,288 @@
+/* File: SongStream.cpp
+ *
+ * Implementation of the SongStream type.
+ *
+ * The background thread checks for work every few milliseconds rather than
+ * being woken by the audio thread, since waking it would mean the audio
+ * thread taking a lock. Patterns last seconds, so the delay doesn't matter.
+ */
+#include "SongStream.h"
+#include "error.h"
+#include <algorithm>
+#include <chrono>
+using namespace std;
+
+namespace {
+    /* How often the background thread looks for patterns to get ready. */
+    const auto kPollInterval = chrono::milliseconds(10);
+}
+
+/* The first few patterns are got ready before the constructor returns, so a
+ * song can start playing the moment it's handed to the audio thread.
+ *
+ * The audio thread only hands a cue back after taking it out of _ready. At
+ * most _prefetch cues are waiting there when the background thread empties
+ * _spent, and at most _prefetch more go in before it empties it again, so
+ * _spent never needs room for more than twice _prefetch.
+ */
+SongStream::SongStream(const string& filename, int prefetch, int sampleRate,
+                       bool fractional, bool loop)
+    : _library(filename), _tuning(Scale::pentatonic(), sampleRate),
+      _prefetch(prefetch), _fractional(fractional), _loop(loop),
+      _ready(max(prefetch, 1)), _spent(2 * max(prefetch, 1)) {
+    if (prefetch <= 0) {
+        error("Songs must prefetch at least one pattern.");
+    }
+    if (_library.size() == 0) {
+        error(filename + " has no patterns in it.");
+    }
+
+    try {
+        fill();
+    } catch (const ErrorException&) {
+        Cue* cue;
+        while (_ready.pop(cue)) discard(cue);
+        throw;
+    }
+    _thread = thread([this] {
+        run();
+    });
+}
+
+SongStream::~SongStream() {
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+
+    Cue* cue;
+    while (_ready.pop(cue)) discard(cue);
+    while (_spent.pop(cue)) discard(cue);
+}
+
+int SongStream::length() const {
+    return _library.size();
+}
+
+SongStream::Cue* SongStream::next() {
+    Cue* cue;
+    if (!_ready.pop(cue)) {
+        if (!_finished.load(memory_order_acquire)) {
+            _underruns.fetch_add(1, memory_order_relaxed);
+        }
+        return nullptr;
+    }
+    _position.store(cue->pattern, memory_order_relaxed);
+    return cue;
+}
+
+void SongStream::release(Cue* cue) {
+    _spent.push(cue);
+}
+
+int SongStream::position() const {
+    return _position.load(memory_order_relaxed);
+}
+
+int SongStream::underruns() const {
+    return _underruns.load(memory_order_relaxed);
+}
+
+void SongStream::waitUntilReady() {
+    unique_lock<mutex> lock(_mutex);
+    if (isReady()) return;
+
+    _hurry = true;
+    _wake.notify_one();
+    _filled.wait(lock, [this] {
+        return isReady();
+    });
+}
+
+/* Whether there's nothing more for the background thread to do until the
+ * audio thread takes another pattern.
+ */
+bool SongStream::isReady() const {
+    return _finished.load(memory_order_acquire) || _ready.size() >= size_t(_prefetch);
+}
+
+/* A pattern that turns out to be damaged ends the song there. */
+void SongStream::run() {
+    unique_lock<mutex> lock(_mutex);
+    while (!_stopping) {
+        lock.unlock();
+        try {
+            fill();
+        } catch (const ErrorException&) {
+            _finished.store(true, memory_order_release);
+        }
+        lock.lock();
+        _filled.notify_all();
+        _wake.wait_for(lock, kPollInterval, [this] {
+            return _stopping || _hurry;
+        });
+        _hurry = false;
+    }
+}
+
+/* Frees what the audio thread has handed back, then gets patterns ready until
+ * _prefetch of them are waiting. Once a pattern is copied, its pages of the
+ * library are given back.
+ */
+void SongStream::fill() {
+    Cue* cue;
+    while (_spent.pop(cue)) discard(cue);
+
+    for (int added = 0; added < _prefetch && !_finished.load(memory_order_relaxed) &&
+                        _ready.size() < size_t(_prefetch); added++) {
+        _ready.push(prepare(_nextPattern));
+        _library.release(_nextPattern);
+
+        _nextPattern++;
+        if (_nextPattern == _library.size()) {
+            if (_loop) {
+                _nextPattern = 0;
+            } else {
+                _finished.store(true, memory_order_release);
+            }
+        }
+    }
+}
+
+/* Everything that might report an error is checked before anything is
+ * allocated, so a damaged pattern doesn't leak.
+ */
+SongStream::Cue* SongStream::prepare(int index) {
+    PatternView pattern = _library.pattern(index);
+    Tempo tempo = pattern.tempo();
+    checkTempo(tempo);
+    int size = pattern.size();
+
+    // Only work the notes out again if the scale changed
+    Scale scale = pattern.scale();
+    if (!_tuning.matches(scale, _tuning.sampleRate())) {
+        _tuning = TuningTable(scale, _tuning.sampleRate());
+    }
+    _tuning.reserve(size);
+
+    Cue* cue = new Cue;
+    cue->pattern = index;
+    cue->size = size;
+    cue->tempo = tempo;
+
+    int words = pattern.wordsPerColumn();
+    cue->columns = new uint64_t[size * words];
+    copy(pattern.columns(), pattern.columns() + size * words, cue->columns);
+    cue->stepScales = new double[size];
+    fill_n(cue->stepScales, size, 1.0);
+
+    cue->strings = new EngineStrings();
+    for (int row = 0; row < size; row++) {
+        if (_fractional) {
+            cue->strings->addPeriod(_tuning.period(row));
+        }
+        else {
+            cue->strings->addLength(_tuning.length(row));
+        }
+    }
+    return cue;
+}
+
+void SongStream::discard(Cue* cue) {
+    delete[] cue->columns;
+    delete[] cue->stepScales;
+    delete cue->strings;
+    delete cue;
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include <cstdio>
+
+namespace {
+    const char kSongFile[] = "SongStreamTest.tmpl";
+
+    /* Lets the background thread catch up, then takes the next pattern. */
+    SongStream::Cue* waitForNext(SongStream& song) {
+        song.waitUntilReady();
+        return song.next();
+    }
+}
+
+STUDENT_TEST("SongStream gets a library's patterns ready in order.") {
+    Tempo fast;
+    fast.stepSamples = 100;
+    Tempo slow;
+    slow.bpm = 90;
+
+    PatternWriter writer;
+    for (int i = 0; i < 5; i++) {
+        int index = writer.add(3 + i, i % 2 == 0? fast : slow,
+                               i % 2 == 0? Scale::pentatonic() : Scale::chromatic());
+        writer.setLight(index, i, 2, true);
+    }
+    writer.save(kSongFile);
+
+    {
+        /* Fewer patterns are prefetched than the song has, so the background
+         * thread has to keep up.
+         */
+        SongStream song(kSongFile, 2, 44100, false, false);
+        EXPECT_EQUAL(song.length(), 5);
+        EXPECT_EQUAL(song.position(), -1);
+
+        for (int i = 0; i < 5; i++) {
+            SongStream::Cue* cue = waitForNext(song);
+            EXPECT(cue != nullptr);
+            if (cue == nullptr) break;
+
+            EXPECT_EQUAL(cue->pattern, i);
+            EXPECT_EQUAL(song.position(), i);
+            EXPECT_EQUAL(cue->size, 3 + i);
+            EXPECT(cue->tempo == (i % 2 == 0? fast : slow));
+            for (int col = 0; col < cue->size; col++) {
+                EXPECT_EQUAL(cue->columns[col], col == 2? uint64_t(1) << i : 0);
+                EXPECT_EQUAL(cue->stepScales[col], 1.0);
+            }
+
+            TuningTable tuning(i % 2 == 0? Scale::pentatonic() : Scale::chromatic(), 44100);
+            tuning.reserve(cue->size);
+            EXPECT_EQUAL(cue->strings->size(), cue->size);
+            for (int row = 0; row < cue->size; row++) {
+                EXPECT_EQUAL(cue->strings->length(row), tuning.length(row));
+            }
+            song.release(cue);
+        }
+
+        /* Once the song is over, coming up empty isn't an underrun. */
+        EXPECT(song.next() == nullptr);
+        EXPECT_EQUAL(song.underruns(), 0);
+    }
+
+    {
+        SongStream song(kSongFile, 3, 44100, false, true);
+        for (int i = 0; i < 12; i++) {
+            SongStream::Cue* cue = waitForNext(song);
+            EXPECT(cue != nullptr);
+            if (cue == nullptr) break;
+            EXPECT_EQUAL(cue->pattern, i % 5);
+            song.release(cue);
+        }
+    }
+    remove(kSongFile);
+}
+
+STUDENT_TEST("SongStream rejects songs it can't play.") {
+    EXPECT_ERROR(SongStream("NoSuchSong.tmpl", 4, 44100, false, false));
+
+    PatternWriter writer;
+    writer.save(kSongFile);
+    EXPECT_ERROR(SongStream(kSongFile, 4, 44100, false, false));
+
+    writer.add(4, Tempo(), Scale::pentatonic());
+    writer.save(kSongFile);
+    EXPECT_ERROR(SongStream(kSongFile, 0, 44100, false, false));
+    remove(kSongFile);
+}
@@ -0,0 +1,123 @@
+/* File: SongStream.h
+ *
+ * Plays the patterns of a PatternLibrary one after another, as a song. A
+ * background thread reads the next few patterns out of the library ahead of
+ * time and gets each one ready to play: its lights copied out in the audio
+ * thread's layout, and a string bank tuned to its scale. The audio thread
+ * picks these up as it needs them, without ever waiting, allocating, or
+ * touching the file, and hands back what it's done with for the background
+ * thread to free.
+ *
+ * Only the patterns close to being played are in memory at any one time.
+ * The library stays mapped, but each pattern's pages are given back once it
+ * has been copied, so a set lasting hours takes no more memory than a short
+ * one.
+ */
+#pragma once
+
+#include "ToneMatrix.h"
+#include "PatternLibrary.h"
+#include "Demos/SPSCQueue.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class SongStream {
+public:
+    /* Opens the library in the given file and starts getting its patterns
+     * ready, up to prefetch of them ahead of the one playing. Strings are
+     * tuned for the given sample rate, to the fraction of a sample if
+     * fractional is set (see ToneMatrix::setFractionalTuning()). If loop is
+     * set, the song starts over after its last pattern. Reports an error if
+     * the file isn't a pattern library or has no patterns in it.
+     */
+    SongStream(const std::string& filename, int prefetch, int sampleRate,
+               bool fractional, bool loop);
+
+    /* Stops the background thread and frees every pattern it got ready. The
+     * audio thread must be done with the stream by this point.
+     */
+    ~SongStream();
+
+    /* Number of patterns in the song. */
+    int length() const;
+
+    /* One pattern, ready to play. The audio thread swaps its own arrays and
+     * strings with the ones in here, then hands the cue back with release().
+     */
+    struct Cue {
+        int pattern;            // Index of the pattern in the library
+        int size;
+        uint64_t* columns;      // In the same format as ToneMatrix::_playColumns
+        double* stepScales;
+        Tempo tempo;
+        EngineStrings* strings;
+    };
+
+    /* Audio thread. Returns the next pattern of the song, or nullptr if the
+     * song is over or the background thread has fallen behind.
+     */
+    Cue* next();
+
+    /* Audio thread. Hands back a cue returned by next(), along with whatever
+     * was swapped into it, for the background thread to free.
+     */
+    void release(Cue* cue);
+
+    /* Index of the pattern most recently returned by next(), or -1 if there
+     * hasn't been one yet.
+     */
+    int position() const;
+
+    /* How many times next() came up empty before the song was over. */
+    int underruns() const;
+
+    /* Waits until the background thread has got as many patterns ready as
+     * it's going to. Playing live, it keeps ahead by itself, but rendering
+     * offline goes far faster than real time, so an offline renderer should
+     * call this before each block. It must not be called from the audio
+     * thread while it's playing live.
+     */
+    void waitUntilReady();
+
+    /* Not copyable; there's a thread attached. */
+    SongStream(const SongStream&) = delete;
+    void operator= (const SongStream&) = delete;
+
+private:
+    /* Owned by the background thread (and by the constructor, before the
+     * thread starts).
+     */
+    PatternLibrary _library;
+    TuningTable _tuning;
+    int _prefetch;
+    bool _fractional;
+    bool _loop;
+    int _nextPattern = 0;
+
+    /* Cues pass from the background thread to the audio thread through
+     * _ready and come back through _spent.
+     */
+    SPSCQueue<Cue*> _ready;
+    SPSCQueue<Cue*> _spent;
+    std::atomic<bool> _finished{false};   // Every pattern has gone into _ready
+    std::atomic<int> _position{-1};
+    std::atomic<int> _underruns{0};
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;     // Tells the background thread to stop or hurry
+    std::condition_variable _filled;   // Tells waitUntilReady() to look again
+    bool _stopping = false;
+    bool _hurry = false;
+
+    void run();
+    void fill();
+    bool isReady() const;
+    Cue* prepare(int index);
+    static void discard(Cue* cue);
+
+    ALLOW_TEST_ACCESS();
+};
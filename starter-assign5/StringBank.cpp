@@ -0,0 +1,769 @@
+/* File: StringBank.cpp
+ *
+ * Implementation of the StringBank type.
+ */
+#include "StringBank.h"
+#include "KarplusStrong.h"
+#include "ParallelRenderer.h"
+#include "WaveformPool.h"
+#include "Demos/AudioSystem.h"
+#include "error.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+using namespace std;
+
+namespace {
+    /* Same string physics as StringInstrument. */
+    const double kDecay          = 0.995;
+    const double kPluckAmplitude = 0.05;
+
+    /* Strings are only put to sleep when the bank's clock reaches a multiple
+     * of this, so the output doesn't depend on how it's split into blocks.
+     */
+    const int kSleepCheckInterval = 1024;
+
+    /* Waveforms are placed on cache line boundaries. */
+    const int kCacheLineBytes = 64;
+
+    template <typename T> int samplesPerCacheLine() {
+        return kCacheLineBytes / sizeof(T);
+    }
+
+    template <typename T> int roundUpToCacheLine(int samples) {
+        int perLine = samplesPerCacheLine<T>();
+        return (samples + perLine - 1) / perLine * perLine;
+    }
+
+    /* Array growth helper: moves the first count elements over to a new
+     * array of the given capacity.
+     */
+    template <typename T> void regrow(T*& array, int count, int capacity) {
+        T* result = new T[capacity];
+        copy(array, array + count, result);
+        delete[] array;
+        array = result;
+    }
+
+    /* Arrays of Samples go through WaveformPool on their own (see
+     * WaveformPool.h), but float arenas have to be sent there by hand.
+     */
+    template <typename T> T* newArena(int samples) {
+        return new T[samples];
+    }
+    template <> float* newArena<float>(int samples) {
+        return static_cast<float*>(WaveformPool::allocate(samples * sizeof(float)));
+    }
+    template <typename T> void deleteArena(T* arena) {
+        delete[] arena;
+    }
+    template <> void deleteArena<float>(float* arena) {
+        WaveformPool::release(arena);
+    }
+
+    /* The kernel works on raw doubles or floats. */
+    double* kernelData(Sample* samples) {
+        static_assert(sizeof(Sample) == sizeof(double), "Sample must be layout-compatible with double.");
+        return reinterpret_cast<double*>(samples);
+    }
+
+    float* kernelData(float* samples) {
+        return samples;
+    }
+}
+
+template <typename T> BasicStringBank<T>::BasicStringBank(double sleepThreshold) {
+    setSleepThreshold(sleepThreshold);
+}
+
+template <typename T> BasicStringBank<T>::~BasicStringBank() {
+    deleteArena(_arenaMemory);
+    delete[] _offsets;
+    delete[] _lengths;
+    delete[] _cursors;
+    delete[] _decays;
+    delete[] _peaks;
+    delete[] _pending;
+    delete[] _sleptAt;
+    delete[] _fractional;
+    delete[] _allpasses;
+    delete[] _active;
+}
+
+template <typename T> int BasicStringBank<T>::size() const {
+    return _size;
+}
+
+template <typename T> void BasicStringBank<T>::add(double frequency) {
+    if (frequency <= 0 || frequency >= AudioSystem::sampleRate()) {
+        error("Frequency must be positive and below the sample rate.");
+    }
+
+    append(AudioSystem::sampleRate() / frequency);
+}
+
+template <typename T> bool BasicStringBank<T>::tryAdd(double frequency) {
+    if (frequency <= 0 || frequency >= AudioSystem::sampleRate()) {
+        error("Frequency must be positive and below the sample rate.");
+    }
+
+    return tryAddLength(AudioSystem::sampleRate() / frequency);
+}
+
+template <typename T> void BasicStringBank<T>::addLength(int length) {
+    if (length <= 0) {
+        error("String length must be positive.");
+    }
+
+    append(length);
+}
+
+template <typename T> bool BasicStringBank<T>::tryAddLength(int length) {
+    if (length <= 0) {
+        error("String length must be positive.");
+    }
+
+    if (_size == _capacity || _arenaUsed + roundUpToCacheLine<T>(length) > _arenaCapacity) {
+        return false;
+    }
+
+    append(length);
+    return true;
+}
+
+template <typename T> void BasicStringBank<T>::addPeriod(double period) {
+    append(lengthForPeriod(period));
+    tune(_size - 1, period);
+}
+
+template <typename T> bool BasicStringBank<T>::tryAddPeriod(double period) {
+    if (!tryAddLength(lengthForPeriod(period))) {
+        return false;
+    }
+
+    tune(_size - 1, period);
+    return true;
+}
+
+/* Checks that a string can repeat every period samples, and returns the length
+ * of its waveform.
+ */
+template <typename T> int BasicStringBank<T>::lengthForPeriod(double period) {
+    if (!(period >= 1 && period < INT_MAX)) {
+        error("String period must be at least one sample.");
+    }
+
+    return int(period);
+}
+
+/* Sets up the allpass filter for a string whose waveform is its period rounded
+ * down. A sample takes length - 1/2 samples to get around the loop without the
+ * filter, so the filter's delay makes up the other 1/2 to 3/2 samples, which
+ * is the range where a first-order allpass is well behaved.
+ */
+template <typename T> void BasicStringBank<T>::tune(int index, double period) {
+    double delay = period - _lengths[index] + 0.5;
+    _fractional[index] = true;
+    _allpasses [index] = KarplusStrong::Allpass<Value>();
+    _allpasses [index].coefficient = Value(KarplusStrong::allpassCoefficient(delay));
+}
+
+/* Adds a silent string with a waveform of the given length. */
+template <typename T> void BasicStringBank<T>::append(int length) {
+    int offset = _arenaUsed;
+
+    growStrings(_size + 1);
+    growArena(offset + roundUpToCacheLine<T>(length));
+
+    /* New strings are silent, so they start out asleep. */
+    fill(_arena + offset, _arena + offset + length, T(0));
+
+    _offsets[_size] = offset;
+    _lengths[_size] = length;
+    _cursors[_size] = 0;
+    _decays [_size] = kDecay;
+    _peaks  [_size] = 0;
+    _pending[_size] = 0;
+    _sleptAt[_size] = _clock;
+    _fractional[_size] = false;
+    _allpasses [_size] = KarplusStrong::Allpass<Value>();
+    _size++;
+    _arenaUsed = offset + roundUpToCacheLine<T>(length);
+}
+
+template <typename T> void BasicStringBank<T>::truncate(int count) {
+    if (count < 0 || count > _size) {
+        error("Cannot truncate a StringBank to " + to_string(count) + " strings.");
+    }
+
+    _size = count;
+    _arenaUsed = count == 0? 0 : _offsets[count - 1] + roundUpToCacheLine<T>(_lengths[count - 1]);
+
+    /* The active list is sorted, so the survivors are a prefix of it. */
+    while (_activeCount > 0 && _active[_activeCount - 1] >= count) {
+        _activeCount--;
+    }
+}
+
+template <typename T> void BasicStringBank<T>::setSleepThreshold(double decibels) {
+    _sleepLevel = pow(10.0, decibels / 20.0);
+}
+
+template <typename T> void BasicStringBank<T>::copyStringsFrom(const BasicStringBank& source, int count) {
+    count = min({ count, _size, source._size });
+    for (int i = 0; i < count; i++) {
+        if (_lengths[i] == source._lengths[i]) {
+            const T* from = source._arena + source._offsets[i];
+            copy(from, from + _lengths[i], _arena + _offsets[i]);
+            _cursors[i] = source.cursor(i);
+            _decays [i] = source._decays [i];
+            _peaks  [i] = source._peaks  [i];
+            _pending[i] = source._pending[i];
+            _sleptAt[i] = source.isAwake(i)? -1 : _clock;
+
+            /* Keep our own tuning, but pick up where the filter left off. */
+            _allpasses[i].lastIn  = source._allpasses[i].lastIn;
+            _allpasses[i].lastOut = source._allpasses[i].lastOut;
+        }
+    }
+
+    /* Rebuild the active list in place. */
+    _activeCount = 0;
+    for (int i = 0; i < _size; i++) {
+        if (_sleptAt[i] < 0) {
+            _active[_activeCount++] = i;
+        }
+    }
+}
+
+template <typename T> void BasicStringBank<T>::pluck(int index) {
+    if (_sleptAt[index] >= 0) {
+        wake(index);
+    }
+
+    T* wave = _arena + _offsets[index];
+    int length   = _lengths[index];
+
+    fill(wave, wave + length / 2, T(+kPluckAmplitude));
+    fill(wave + length / 2, wave + length, T(-kPluckAmplitude));
+    _cursors[index] = 0;
+    _peaks  [index] = kPluckAmplitude;
+    _pending[index] = 0;
+
+    /* The allpass can ring past its input by as much as (1 + |a|) / (1 - |a|),
+     * so its strings start out with a looser bound.
+     */
+    if (_fractional[index]) {
+        double coefficient = fabs(double(_allpasses[index].coefficient));
+        _peaks[index] *= (1 + coefficient) / (1 - coefficient);
+        _allpasses[index].lastIn  = 0;
+        _allpasses[index].lastOut = 0;
+    }
+}
+
+template <typename T> void BasicStringBank<T>::render(Value* out, int frames, ParallelRenderer* parallel,
+                                                      bool clampOutput) {
+    while (frames > 0) {
+        int span = int(min<int64_t>(frames, kSleepCheckInterval - _clock % kSleepCheckInterval));
+
+        if (parallel != nullptr) {
+            parallel->render(*this, out, span);
+        } else {
+            renderVoices(out, span, 0, _activeCount);
+        }
+
+        // Silence can't need clamping
+        if (clampOutput && _activeCount > 0) {
+            for (int i = 0; i < span; i++) {
+                out[i] = min(Value(1), max(Value(-1), out[i]));
+            }
+        }
+
+        _clock += span;
+        settle(span, _clock % kSleepCheckInterval == 0);
+
+        out    += span;
+        frames -= span;
+    }
+}
+
+template <typename T> void BasicStringBank<T>::renderVoices(Value* out, int frames, int begin, int end) {
+    if (begin == end) {
+        fill(out, out + frames, Value(0));
+    }
+
+    /* Walk the strings in arena order. The first one overwrites out and the
+     * rest mix into it.
+     */
+    for (int k = begin; k < end; k++) {
+        int i = _active[k];
+        if (_fractional[i]) {
+            KarplusStrong::render(kernelData(_arena + _offsets[i]), _lengths[i], _cursors[i],
+                                  out, frames, _decays[i], _allpasses[i], k > begin);
+        } else {
+            KarplusStrong::render(kernelData(_arena + _offsets[i]), _lengths[i], _cursors[i],
+                                  out, frames, _decays[i], k > begin);
+        }
+    }
+}
+
+template <typename T> const T* BasicStringBank<T>::waveform(int index) const {
+    return _arena + _offsets[index];
+}
+
+template <typename T> int BasicStringBank<T>::length(int index) const {
+    return _lengths[index];
+}
+
+template <typename T> int BasicStringBank<T>::cursor(int index) const {
+    if (_sleptAt[index] < 0) return _cursors[index];
+
+    /* A sleeping string's cursor keeps moving even though we don't touch it. */
+    int length = _lengths[index];
+    return (_cursors[index] + (_clock - _sleptAt[index]) % length) % length;
+}
+
+template <typename T> bool BasicStringBank<T>::isAwake(int index) const {
+    return _sleptAt[index] < 0;
+}
+
+template <typename T> int BasicStringBank<T>::activeCount() const {
+    return _activeCount;
+}
+
+/* Adds a sleeping string to the active list, keeping the list sorted. Its
+ * cursor is brought up to date so it can be rendered normally again.
+ */
+template <typename T> void BasicStringBank<T>::wake(int index) {
+    _cursors[index] = cursor(index);
+    _sleptAt[index] = -1;
+
+    int pos = _activeCount;
+    while (pos > 0 && _active[pos - 1] > index) {
+        _active[pos] = _active[pos - 1];
+        pos--;
+    }
+    _active[pos] = index;
+    _activeCount++;
+}
+
+/* Called after rendering frames samples. Tightens the peak bound of each awake
+ * string by however many full periods it just ran through. If maySleep is set,
+ * it then puts to sleep any string whose bound has fallen below the threshold.
+ * Zeroing the waveform makes the sleeping string exactly silent rather than
+ * just nearly so.
+ */
+template <typename T> void BasicStringBank<T>::settle(int frames, bool maySleep) {
+    int kept = 0;
+    for (int k = 0; k < _activeCount; k++) {
+        int i = _active[k];
+
+        int64_t pending = int64_t(_pending[i]) + frames;
+        if (pending >= _lengths[i]) {
+            _peaks[i] *= pow(_decays[i], double(pending / _lengths[i]));
+            pending %= _lengths[i];
+        }
+        _pending[i] = int(pending);
+
+        if (maySleep && _peaks[i] < _sleepLevel) {
+            T* wave = _arena + _offsets[i];
+            fill(wave, wave + _lengths[i], T(0));
+            _allpasses[i].lastIn  = 0;
+            _allpasses[i].lastOut = 0;
+            _sleptAt[i] = _clock;
+        } else {
+            _active[kept++] = i;
+        }
+    }
+    _activeCount = kept;
+}
+
+/* Makes sure there's room for at least minCapacity strings. */
+template <typename T> void BasicStringBank<T>::growStrings(int minCapacity) {
+    if (minCapacity <= _capacity) return;
+
+    int capacity = max(minCapacity, 2 * _capacity);
+    regrow(_offsets, _size, capacity);
+    regrow(_lengths, _size, capacity);
+    regrow(_cursors, _size, capacity);
+    regrow(_decays,  _size, capacity);
+    regrow(_peaks,   _size, capacity);
+    regrow(_pending, _size, capacity);
+    regrow(_sleptAt, _size, capacity);
+    regrow(_fractional, _size, capacity);
+    regrow(_allpasses,  _size, capacity);
+    regrow(_active,  _activeCount, capacity);
+    _capacity = capacity;
+}
+
+/* Makes sure the arena can hold at least minCapacity samples. Offsets are
+ * relative to the start of the arena, so they survive the move.
+ */
+template <typename T> void BasicStringBank<T>::growArena(int minCapacity) {
+    if (minCapacity <= _arenaCapacity) return;
+
+    int capacity = max(minCapacity, 2 * _arenaCapacity);
+
+    /* Over-allocate by a cache line so we can line up the start. */
+    T* memory = newArena<T>(capacity + samplesPerCacheLine<T>());
+    uintptr_t address = reinterpret_cast<uintptr_t>(memory);
+    uintptr_t aligned = (address + kCacheLineBytes - 1) & ~uintptr_t(kCacheLineBytes - 1);
+    T* arena = memory + (aligned - address) / sizeof(T);
+
+    copy(_arena, _arena + _arenaUsed, arena);
+    deleteArena(_arenaMemory);
+
+    _arenaMemory   = memory;
+    _arena         = arena;
+    _arenaCapacity = capacity;
+}
+
+template class BasicStringBank<Sample>;
+template class BasicStringBank<float>;
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include "StringInstrument.h"
+#include <complex>
+
+STUDENT_TEST("StringBank produces the same samples as separate StringInstruments.") {
+    AudioSystem::setSampleRate(44100);
+
+    const double kFrequencies[] = { 110, 220, 261.6, 440, 987.7 };
+
+    StringBank bank;
+    StringInstrument* instruments = new StringInstrument[5];
+    for (int i = 0; i < 5; i++) {
+        bank.add(kFrequencies[i]);
+        instruments[i] = StringInstrument(kFrequencies[i]);
+        EXPECT_EQUAL(bank.length(i), instruments[i]._length);
+    }
+    EXPECT_EQUAL(bank.size(), 5);
+
+    /* Every waveform should start on its own cache line. */
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQUAL(reinterpret_cast<uintptr_t>(bank.waveform(i)) % 64, 0);
+    }
+
+    /* Pluck a couple of strings and compare the mixed output. */
+    bank.pluck(1);
+    bank.pluck(3);
+    instruments[1].pluck();
+    instruments[3].pluck();
+
+    double block[300];
+    for (int pass = 0; pass < 20; pass++) {
+        bank.render(block, 300);
+        for (int i = 0; i < 300; i++) {
+            Sample expected = 0;
+            for (int j = 0; j < 5; j++) {
+                expected += instruments[j].nextSample();
+            }
+            EXPECT_EQUAL(Sample(block[i]), expected);
+        }
+    }
+
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQUAL(bank.cursor(i), instruments[i]._cursor);
+    }
+
+    delete[] instruments;
+}
+
+STUDENT_TEST("StringBank keeps existing strings when growing and shrinking.") {
+    AudioSystem::setSampleRate(44100);
+
+    StringBank bank;
+    bank.add(440);
+    bank.pluck(0);
+
+    double block[10];
+    bank.render(block, 10);
+
+    /* Adding lots of strings forces the arena to move. */
+    for (int i = 0; i < 50; i++) {
+        bank.add(220);
+    }
+    EXPECT_EQUAL(bank.size(), 51);
+    EXPECT_EQUAL(bank.cursor(0), 10);
+    EXPECT_EQUAL(bank.waveform(0)[50], -0.05);
+
+    /* Shrinking leaves the survivors alone. */
+    bank.truncate(1);
+    EXPECT_EQUAL(bank.size(), 1);
+    EXPECT_EQUAL(bank.cursor(0), 10);
+
+    EXPECT_ERROR(bank.truncate(2));
+    EXPECT_ERROR(bank.add(0));
+    EXPECT_ERROR(bank.add(44100));
+}
+
+STUDENT_TEST("StringBank only renders strings that are loud enough to hear.") {
+    AudioSystem::setSampleRate(44100);
+
+    StringBank bank;
+    for (int i = 0; i < 10; i++) {
+        bank.add(220 + 10 * i);
+    }
+
+    /* Strings that were never plucked are asleep and render as silence. */
+    EXPECT_EQUAL(bank.activeCount(), 0);
+    double block[500];
+    bank.render(block, 500);
+    for (int i = 0; i < 500; i++) {
+        EXPECT_EQUAL(block[i], 0.0);
+    }
+
+    /* Plucking wakes a string up, and its cursor kept time while it slept. */
+    bank.pluck(7);
+    bank.pluck(2);
+    EXPECT_EQUAL(bank.activeCount(), 2);
+    EXPECT_EQUAL(bank._active[0], 2);
+    EXPECT_EQUAL(bank._active[1], 7);
+    EXPECT_EQUAL(bank.cursor(4), 500 % bank.length(4));
+
+    /* Awake strings sound just like a StringInstrument. */
+    StringInstrument reference(220 + 10 * 7);
+    reference.pluck();
+    StringBank single;
+    single.add(220 + 10 * 7);
+    single.pluck(0);
+    for (int pass = 0; pass < 10; pass++) {
+        single.render(block, 500);
+        for (int i = 0; i < 500; i++) {
+            EXPECT_EQUAL(Sample(block[i]), reference.nextSample());
+        }
+    }
+
+    /* Eventually the string decays below -96dB and goes back to sleep. Until
+     * then, it never differs from the real string by more than the threshold.
+     */
+    const double kThreshold = pow(10.0, -96.0 / 20.0);
+    int rendered = 0;
+    while (single.isAwake(0)) {
+        single.render(block, 500);
+        for (int i = 0; i < 500; i++) {
+            EXPECT(fabs(block[i] - reference.nextSample()) < kThreshold);
+        }
+        rendered += 500;
+        if (rendered > 50 * 44100) break;
+    }
+    EXPECT(!single.isAwake(0));
+    EXPECT_EQUAL(single.cursor(0), reference._cursor);
+
+    /* A sleeping string is exactly silent, and plucking it brings it back. */
+    single.render(block, 500);
+    for (int i = 0; i < 500; i++) {
+        EXPECT_EQUAL(block[i], 0.0);
+    }
+    single.pluck(0);
+    EXPECT(single.isAwake(0));
+}
+
+STUDENT_TEST("StringBank sleep threshold is configurable.") {
+    AudioSystem::setSampleRate(44100);
+
+    /* At -20dB a freshly plucked string (-26dB) is already too quiet. */
+    StringBank bank(-20);
+    bank.add(440);
+    bank.pluck(0);
+    EXPECT(bank.isAwake(0));
+
+    /* Strings only fall asleep on a sleep check, which happens every 1024
+     * samples.
+     */
+    double block[1024];
+    bank.render(block, 10);
+    EXPECT(bank.isAwake(0));
+    bank.render(block, 1014);
+    EXPECT(!bank.isAwake(0));
+    EXPECT_EQUAL(bank.cursor(0), 1024 % bank.length(0));
+
+    /* Lowering the threshold lets it ring. */
+    bank.setSleepThreshold(-60);
+    bank.pluck(0);
+    bank.render(block, 1024);
+    EXPECT(bank.isAwake(0));
+
+    /* Copying state carries sleep along with it. */
+    StringBank copy;
+    copy.add(440);
+    copy.copyStringsFrom(bank, 1);
+    EXPECT(copy.isAwake(0));
+    EXPECT_EQUAL(copy.activeCount(), 1);
+    EXPECT_EQUAL(copy.cursor(0), 1024 % copy.length(0));
+}
+
+STUDENT_TEST("FloatStringBank follows the double-precision reference closely.") {
+    AudioSystem::setSampleRate(44100);
+
+    const double kFrequencies[] = { 110, 220, 261.6, 440, 987.7 };
+
+    StringBank reference;
+    FloatStringBank bank;
+    for (double frequency: kFrequencies) {
+        reference.add(frequency);
+        bank.add(frequency);
+    }
+    EXPECT_EQUAL(reinterpret_cast<uintptr_t>(bank.waveform(4)) % 64, 0);
+
+    for (int i = 0; i < 5; i++) {
+        reference.pluck(i);
+        bank.pluck(i);
+    }
+
+    /* Floats carry about seven digits, which is still far below anything
+     * audible.
+     */
+    double expected[1000];
+    float block[1000];
+    for (int pass = 0; pass < 50; pass++) {
+        reference.render(expected, 1000);
+        bank.render(block, 1000);
+        for (int i = 0; i < 1000; i++) {
+            EXPECT(fabs(block[i] - expected[i]) < 1e-6);
+        }
+    }
+
+    /* The vectorized kernel matches plain single-precision arithmetic
+     * exactly. Strings asleep in one are asleep in the other.
+     */
+    FloatStringBank single;
+    single.add(261.6);
+    single.pluck(0);
+    int length = single.length(0);
+    float* wave = new float[length];
+    copy(single.waveform(0), single.waveform(0) + length, wave);
+
+    single.render(block, 1000);
+    int cursor = 0;
+    for (int i = 0; i < 1000; i++) {
+        float thisOne = wave[cursor];
+        wave[cursor] = float(0.995) * ((thisOne + wave[(cursor + 1) % length]) / 2);
+        EXPECT_EQUAL(block[i], thisOne);
+        cursor = (cursor + 1) % length;
+    }
+    delete[] wave;
+
+    for (int i = 0; i < 5; i++) {
+        EXPECT_EQUAL(bank.isAwake(i), reference.isAwake(i));
+        EXPECT_EQUAL(bank.cursor(i), reference.cursor(i));
+    }
+}
+
+namespace {
+    /* Estimates how many samples one cycle of the given sound lasts, assuming
+     * it's somewhere near guess. It picks out the fundamental with a windowed
+     * Fourier sum, once starting at the first sample and once starting at the
+     * second; how far the phase turns between the two is the frequency.
+     */
+    double measuredPeriod(const double* samples, int count, double guess) {
+        const double kTwoPi = 4 * acos(0.0);
+        complex<double> here = 0, next = 0;
+        for (int i = 0; i + 1 < count; i++) {
+            double window = 0.5 - 0.5 * cos(kTwoPi * i / (count - 2));
+            complex<double> turn = polar(window, -kTwoPi * i / guess);
+            here += samples[i] * turn;
+            next += samples[i + 1] * turn;
+        }
+        return kTwoPi / arg(next / here);
+    }
+}
+
+STUDENT_TEST("Strings added by period are in tune to a fraction of a sample.") {
+    AudioSystem::setSampleRate(44100);
+
+    /* High notes, where rounding off the length matters most. */
+    const double kPeriods[] = { 21.07, 17.5, 12.25, 31.9 };
+    const int kSamples = 8192;
+
+    for (double period: kPeriods) {
+        StringBank whole, fractional;
+        whole.addLength(int(period));
+        fractional.addPeriod(period);
+        EXPECT_EQUAL(fractional.length(0), int(period));
+
+        whole.pluck(0);
+        fractional.pluck(0);
+
+        /* Skip the start, while the square wave of the pluck smooths out. A
+         * string without the filter repeats every length - 1/2 samples.
+         */
+        double* samples = new double[kSamples];
+        double rounded = int(period) - 0.5;
+        whole.render(samples, 2048);
+        whole.render(samples, kSamples);
+        EXPECT(fabs(measuredPeriod(samples, kSamples, rounded) - rounded) < 0.01);
+
+        fractional.render(samples, 2048);
+        fractional.render(samples, kSamples);
+        EXPECT(fabs(measuredPeriod(samples, kSamples, period) - period) < 0.01);
+        delete[] samples;
+    }
+
+    EXPECT_ERROR(StringBank().addPeriod(0.5));
+}
+
+STUDENT_TEST("Fractionally tuned strings work in either precision and still sleep.") {
+    AudioSystem::setSampleRate(44100);
+
+    StringBank reference;
+    FloatStringBank bank;
+    reference.add(440);
+    bank.add(440);
+    reference.addPeriod(44100 / 1046.5);
+    bank.addPeriod(44100 / 1046.5);
+    for (int i = 0; i < 2; i++) {
+        reference.pluck(i);
+        bank.pluck(i);
+    }
+
+    double expected[1000];
+    float block[1000];
+    for (int pass = 0; pass < 20; pass++) {
+        reference.render(expected, 1000);
+        bank.render(block, 1000);
+        for (int i = 0; i < 1000; i++) {
+            EXPECT(fabs(block[i] - expected[i]) < 1e-6);
+        }
+    }
+
+    /* The string still dies away and goes to sleep, leaving silence and a
+     * filter with nothing left in it.
+     */
+    int rendered = 0;
+    while (reference.isAwake(1) && rendered < 50 * 44100) {
+        reference.render(expected, 1000);
+        rendered += 1000;
+    }
+    EXPECT(!reference.isAwake(1));
+    EXPECT_EQUAL(reference._allpasses[1].lastOut, 0.0);
+
+    /* Room left by truncate() takes a fractional string of the same length. */
+    reference.truncate(1);
+    EXPECT(reference.tryAddPeriod(44100 / 1046.5 + 0.2));
+    EXPECT(reference._fractional[1]);
+    EXPECT(!reference._fractional[0]);
+}
+
+STUDENT_TEST("FloatStringBank can clamp its output for the sound card as it mixes.") {
+    /* Forty strings plucked at once add up to well past full scale. */
+    FloatStringBank loud, clamped;
+    for (int i = 0; i < 40; i++) {
+        loud.addLength(100 + i);
+        clamped.addLength(100 + i);
+        loud.pluck(i);
+        clamped.pluck(i);
+    }
+
+    float expected[3000], block[3000];
+    loud.render(expected, 3000);
+    clamped.render(block, 3000, nullptr, true);
+
+    bool clipped = false;
+    for (int i = 0; i < 3000; i++) {
+        EXPECT_EQUAL(block[i], min(1.0f, max(-1.0f, expected[i])));
+        clipped = clipped || fabs(expected[i]) > 1;
+    }
+    EXPECT(clipped);
+}
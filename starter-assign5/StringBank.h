@@ -0,0 +1,186 @@
+/* File: StringBank.h
+ *
+ * A collection of plucked strings stored structure-of-arrays style. Rather
+ * than giving each string its own heap-allocated waveform, every waveform
+ * lives in one contiguous arena, and the per-string bookkeeping (where its
+ * waveform starts, how long it is, where its cursor is, how fast it decays)
+ * lives in parallel arrays. Rendering walks the arena front to back.
+ *
+ * Strings that are too quiet to hear are put to sleep and skipped entirely
+ * until they're plucked again, so silent rows cost nothing to render.
+ *
+ * StringBank keeps its waveforms as Samples and renders doubles. It's the
+ * reference that the tests check everything else against. FloatStringBank
+ * does the same work in single precision: its waveforms take half the memory,
+ * and it renders floats, the format the sound card wants.
+ */
+#pragma once
+
+#include "GUI/SimpleTest.h"
+#include "Demos/Sample.h"
+#include "KarplusStrong.h"
+#include <cstdint>
+#include <type_traits>
+
+class ParallelRenderer;
+
+template <typename T> class BasicStringBank {
+public:
+    /* Type of the samples render() produces. */
+    using Value = typename std::conditional<std::is_same<T, float>::value, float, double>::type;
+
+    /* Creates an empty bank of strings. Strings whose level drops below
+     * the given threshold, in decibels relative to full scale, are put
+     * to sleep.
+     */
+    explicit BasicStringBank(double sleepThreshold = kDefaultSleepThreshold);
+
+    /* Quieter than the last bit of 16-bit audio. */
+    static constexpr double kDefaultSleepThreshold = -96.0;
+
+    /* Frees all memory allocated by the bank. */
+    ~BasicStringBank();
+
+    /* Returns how many strings are in the bank. */
+    int size() const;
+
+    /* Adds a new, silent string that vibrates at the given frequency to the
+     * end of the bank. Reports an error if the frequency is out of range
+     * for the current sample rate.
+     */
+    void add(double frequency);
+
+    /* Like add(), except that it never allocates memory, so it's safe to
+     * call from the audio thread. If the bank doesn't already have room for
+     * the string, nothing happens and this returns false. Strings that were
+     * removed by truncate() leave room behind for strings of the same
+     * lengths.
+     */
+    bool tryAdd(double frequency);
+
+    /* Same as add() and tryAdd(), but for a string whose waveform has the
+     * given length, as worked out by a TuningTable.
+     */
+    void addLength(int length);
+    bool tryAddLength(int length);
+
+    /* Same as addLength() and tryAddLength(), but for a string that repeats
+     * exactly every period samples, fractions of a sample included, as
+     * worked out by a TuningTable. The waveform is the period rounded down,
+     * and an allpass filter in the string's feedback loop makes up the rest,
+     * so the note is in tune even when the period is only a few samples long.
+     * Strings added any other way don't have the filter and don't pay for it.
+     */
+    void addPeriod(double period);
+    bool tryAddPeriod(double period);
+
+    /* Removes strings from the end of the bank so that only the first
+     * count remain. The remaining strings are left untouched.
+     */
+    void truncate(int count);
+
+    /* Changes the level, in decibels relative to full scale, below which
+     * strings are put to sleep. This takes effect at the next render().
+     */
+    void setSleepThreshold(double decibels);
+
+    /* Copies the current state (waveform, cursor, and decay) of the first
+     * count strings of source over the matching strings in this bank. Strings
+     * whose lengths don't match are left alone. This never allocates memory,
+     * so it's safe to call from the audio thread.
+     */
+    void copyStringsFrom(const BasicStringBank& source, int count);
+
+    /* Plucks the string at the given index, waking it up if need be. */
+    void pluck(int index);
+
+    /* Generates the next frames samples from every string in the bank and
+     * writes their sum into out. This is the same as calling nextSample()
+     * on a StringInstrument for each string, frames times over, and adding
+     * the results together, except that strings below the sleep threshold
+     * are treated as silent. Sleep is only checked every so often, at fixed
+     * points in time, so the results don't depend on the block size.
+     *
+     * If a ParallelRenderer is given, it's used to spread the strings over
+     * several threads. If clampOutput is set, the samples are clamped to the
+     * range from -1 to +1 that a sound card accepts, a stretch at a time as
+     * soon as each stretch is mixed, while it's still in cache.
+     */
+    void render(Value* out, int frames, ParallelRenderer* parallel = nullptr, bool clampOutput = false);
+
+    /* Renders frames samples from just the awake strings in positions begin
+     * up to end of the active list, and writes their sum into out. This
+     * doesn't move the bank's clock forward or put strings to sleep, so it's
+     * only meant to be called by render() and ParallelRenderer. Calls for
+     * ranges that don't overlap can safely run at the same time.
+     */
+    void renderVoices(Value* out, int frames, int begin, int end);
+
+    /* Read-only views of each string's state, mostly useful for testing. */
+    const T* waveform(int index) const;
+    int length(int index) const;
+    int cursor(int index) const;
+    bool isAwake(int index) const;
+    int activeCount() const;
+
+    /* Copying a bank would mean copying every waveform; there's no need. */
+    BasicStringBank(const BasicStringBank&) = delete;
+    void operator= (const BasicStringBank&) = delete;
+
+private:
+    /* The arena itself. _arenaMemory is what we got from new[], and _arena is
+     * that rounded up to a cache line. Each waveform starts on a cache line of
+     * its own.
+     */
+    T* _arenaMemory = nullptr;
+    T* _arena = nullptr;
+    int _arenaUsed = 0;
+    int _arenaCapacity = 0;
+
+    /* Parallel arrays, one entry per string. */
+    int*    _offsets = nullptr;
+    int*    _lengths = nullptr;
+    int*    _cursors = nullptr;
+    double* _decays  = nullptr;
+    int _size = 0;
+    int _capacity = 0;
+
+    /* Sleep bookkeeping, also one entry per string. _peaks holds an upper
+     * bound on the size of any sample in the waveform. Every time a string
+     * runs through a full period, that bound shrinks by its decay factor;
+     * _pending counts samples toward the next period. _sleptAt is the value
+     * of _clock when the string went to sleep, or -1 if it's awake. A
+     * sleeping string's waveform is all zeros, so its cursor can be worked
+     * out from how long it's been asleep.
+     */
+    double*  _peaks   = nullptr;
+    int*     _pending = nullptr;
+    int64_t* _sleptAt = nullptr;
+    int64_t  _clock   = 0;
+
+    /* Fractional tuning, one entry per string. Only strings with _fractional
+     * set run their waveform through their allpass filter.
+     */
+    bool* _fractional = nullptr;
+    KarplusStrong::Allpass<Value>* _allpasses = nullptr;
+
+    /* Indices of the strings that are awake, in increasing order. */
+    int* _active = nullptr;
+    int _activeCount = 0;
+
+    /* Sleep threshold as a plain amplitude. */
+    double _sleepLevel;
+
+    void append(int length);
+    void tune(int index, double period);
+    static int lengthForPeriod(double period);
+    void growStrings(int minCapacity);
+    void growArena(int minCapacity);
+    void wake(int index);
+    void settle(int frames, bool maySleep);
+
+    ALLOW_TEST_ACCESS();
+};
+
+using StringBank      = BasicStringBank<Sample>;
+using FloatStringBank = BasicStringBank<float>;
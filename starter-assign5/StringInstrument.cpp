@@ -8,6 +8,7 @@
 
 #include "Demos/AudioSystem.h"
 #include "StringInstrument.h"
+#include "KarplusStrong.h"
 #include "error.h"
 using namespace std;
 
@@ -59,13 +60,22 @@ void StringInstrument::pluck() {
 
 /* The nextSample function returns the next sound sample and updates the _waveform buffer and cursor position. */
 Sample StringInstrument::nextSample() {
-    Sample thisOne = _waveform[_cursor];
-
-    Sample average = AVERAGE * ((_waveform[_cursor] + _waveform[(_cursor + 1) % _length]) / 2);
-    _waveform[_cursor] = average;
-    _cursor = (_cursor + 1) % _length;
+    double thisOne;
+    render(&thisOne, 1, false);
     return thisOne;
+}
+
 
+/* The render function produces n samples in a row. The vectorized kernel takes
+ * care of sweeping from the cursor up to the end of the buffer and wrapping
+ * back around to the start. */
+void StringInstrument::render(double* out, int n, bool accumulate) {
+    /* Sample is just a wrapper around a double, so the waveform can be handed
+     * to the kernel as an array of doubles. */
+    static_assert(sizeof(Sample) == sizeof(double), "Sample must be layout-compatible with double.");
+    double* wave = reinterpret_cast<double*>(_waveform);
+
+    KarplusStrong::render(wave, _length, _cursor, out, n, AVERAGE, accumulate);
 }
 
 /* * * * * Test Cases Below This Point * * * * */
@@ -144,6 +154,72 @@ STUDENT_TEST("Milestone 4: nextSample works if pluck not called.") {
 }
 
 
+STUDENT_TEST("render() produces the same samples as repeated calls to nextSample().") {
+    AudioSystem::setSampleRate(44100);
+
+    StringInstrument bySample(440);
+    StringInstrument byBlock(440);
+    bySample.pluck();
+    byBlock.pluck();
+
+    /* Blocks of 37 samples never line up with the 100-sample waveform, so
+     * this checks the wraparound in the middle of a block.
+     */
+    double block[37];
+    for (int pass = 0; pass < 20; pass++) {
+        byBlock.render(block, 37, false);
+        for (int i = 0; i < 37; i++) {
+            EXPECT_EQUAL(Sample(block[i]), bySample.nextSample());
+        }
+        EXPECT_EQUAL(byBlock._cursor, bySample._cursor);
+    }
+
+    /* Accumulating adds on top of what's already there. */
+    for (int i = 0; i < 37; i++) {
+        block[i] = 1.0;
+    }
+    Sample expected = bySample.nextSample();
+    byBlock.render(block, 37, true);
+    EXPECT_EQUAL(Sample(block[0]), 1.0 + expected);
+}
+
+STUDENT_TEST("render() matches the waveform update rule across many wraparounds.") {
+    AudioSystem::setSampleRate(44100);
+
+    /* 44100 / 300 = 147 samples, an odd length that leaves leftovers in
+     * every vector-sized chunk.
+     */
+    StringInstrument instrument(300);
+    instrument.pluck();
+
+    /* Reference copy of the waveform, updated the slow way. */
+    const int length = instrument._length;
+    EXPECT_EQUAL(length, 147);
+    double reference[147];
+    for (int i = 0; i < length; i++) {
+        reference[i] = instrument._waveform[i];
+    }
+
+    int cursor = 0;
+    double block[500];
+    for (int pass = 0; pass < 10; pass++) {
+        instrument.render(block, 500, false);
+
+        for (int i = 0; i < 500; i++) {
+            double thisOne = reference[cursor];
+            reference[cursor] = 0.995 * ((reference[cursor] + reference[(cursor + 1) % length]) / 2);
+            cursor = (cursor + 1) % length;
+
+            EXPECT_EQUAL(Sample(block[i]), Sample(thisOne));
+        }
+    }
+
+    EXPECT_EQUAL(instrument._cursor, cursor);
+    for (int i = 0; i < length; i++) {
+        EXPECT_EQUAL(instrument._waveform[i], reference[i]);
+    }
+}
+
 PROVIDED_TEST("Milestone 2: Waveform array initialized correctly.") {
     /* Change the sample rate to 3, just to make the numbers come out nice. */
     AudioSystem::setSampleRate(3);
@@ -325,6 +401,42 @@ PROVIDED_TEST("Milestone 4: nextSample wraps around properly.") {
     EXPECT_EQUAL(instrument._waveform[1], 0.995 * (decayedTerm + moreDecayed) / 2.0);
 }
 
+STUDENT_TEST("Moving a StringInstrument hands over its waveform instead of copying it.") {
+    AudioSystem::setSampleRate(44100);
+
+    StringInstrument original(440);
+    original.pluck();
+    original.nextSample();
+    Sample* waveform = original._waveform;
+
+    /* Move construction takes the waveform and leaves the original empty. */
+    StringInstrument moved(std::move(original));
+    EXPECT_EQUAL(moved._waveform, waveform);
+    EXPECT_EQUAL(moved._cursor, 1);
+    EXPECT_EQUAL(original._waveform, nullptr);
+
+    /* Move assignment does the same, and the old waveform gets freed. */
+    StringInstrument target(220);
+    target = std::move(moved);
+    EXPECT_EQUAL(target._waveform, waveform);
+    EXPECT_EQUAL(target._length, 100);
+
+    /* Assigning a temporary moves it rather than copying it. */
+    target = StringInstrument(441);
+    EXPECT_NOT_EQUAL(target._waveform, waveform);
+    EXPECT_EQUAL(target._length, 100);
+
+    /* Copies still get waveforms of their own. */
+    StringInstrument copy(220);
+    copy = target;
+    EXPECT_NOT_EQUAL(copy._waveform, target._waveform);
+    EXPECT_EQUAL(copy._length, target._length);
+
+    /* Something that was moved from can be given a new value. */
+    original = copy;
+    EXPECT_EQUAL(original._length, 100);
+}
+
 // STUDENT_TEST("Milestone 4: Keeps track of current column and how may more calls to nextSample()") {
 //     _col = 0;
 
@@ -378,7 +490,25 @@ StringInstrument::StringInstrument(const StringInstrument& rhs) {
  * details about how this works. This specific implementation uses an idiom
  * called "copy-and-swap."
  */
-StringInstrument& StringInstrument::operator =(StringInstrument rhs) {
+StringInstrument& StringInstrument::operator =(const StringInstrument& rhs) {
+    StringInstrument copy(rhs);
+    return *this = std::move(copy);
+}
+
+/* Move constructor for StringInstrument. This steals the waveform from a
+ * StringInstrument that's about to be destroyed rather than copying it.
+ */
+StringInstrument::StringInstrument(StringInstrument&& rhs) noexcept
+    : _waveform(rhs._waveform), _length(rhs._length), _cursor(rhs._cursor) {
+    rhs._waveform = nullptr;
+    rhs._length   = 0;
+    rhs._cursor   = 0;
+}
+
+/* Move assignment operator for StringInstrument. Swapping hands our old
+ * waveform to rhs, which frees it when it's destroyed.
+ */
+StringInstrument& StringInstrument::operator =(StringInstrument&& rhs) noexcept {
     swap(_length,   rhs._length);
     swap(_waveform, rhs._waveform);
     swap(_cursor,   rhs._cursor);
@@ -28,6 +28,14 @@ public:
     /* Returns the next sound sample generated by the string. */
     Sample nextSample();
 
+    /* Generates the next n sound samples from the string and writes them
+     * into out. If accumulate is true, the samples are added to whatever
+     * is already in out rather than overwriting it, which makes it easy
+     * to mix several strings into the same buffer. Produces exactly the
+     * same samples as n calls to nextSample().
+     */
+    void render(double* out, int n, bool accumulate);
+
     /* These two special functions are called a copy constructor and
      * copy assignment operator. They're covered in detail in the
      * textbook (Ch 12.7) and in CS106L. Because we didn't cover these
@@ -35,7 +43,16 @@ public:
      * and you are not expected to understand how they work.
      */
     StringInstrument(const StringInstrument& rhs);
-    StringInstrument& operator= (StringInstrument rhs);
+    StringInstrument& operator= (const StringInstrument& rhs);
+
+    /* The move constructor and move assignment operator. These take over
+     * the waveform of a StringInstrument that's about to go away, such as a
+     * temporary, instead of copying it. The StringInstrument that was moved
+     * from is left without a waveform, and can only be destroyed or assigned
+     * to.
+     */
+    StringInstrument(StringInstrument&& rhs) noexcept;
+    StringInstrument& operator= (StringInstrument&& rhs) noexcept;
 
     /* Detect any memory leaks where a StringInstrument was allocated but
      * then not deallocated.
@@ -47,10 +64,10 @@ private:
     Sample* _waveform = nullptr;
 
     /* How many samples are in the waveform. */
-    int _length;
+    int _length = 0;
 
     /* Where the cursor is within the array. */
-    int _cursor;
+    int _cursor = 0;
 
     /* Give SimpleTest access to the private data members of this type so
      * that they can be inspected in tests.
@@ -64,6 +64,10 @@ DESTDIR     =   $$PWD
 # Ask Julie if you are curious why main->qMain->studentMain
 DEFINES     +=  main=qMain qMain=studentMain
 
+# Run "qmake CONFIG+=float32" to build the sound engine in single precision.
+# The tests expect the default double-precision engine.
+float32: DEFINES += TONE_MATRIX_FLOAT32
+
 ###############################################################################
 #       Gather files to list in Qt Creator project browser                    #
 ###############################################################################
@@ -80,6 +84,11 @@ HEADERS         *=  ""
 SOURCES         *=  $$files(*.cpp, true)
 HEADERS         *=  $$files(*.h, true)
 
+# The Tools folder holds separate command-line programs with their own main()
+# and their own project files (e.g. HeadlessRender.pro); keep them out of here.
+SOURCES         -=  $$files(Tools/*.cpp, true)
+HEADERS         -=  $$files(Tools/*.h, true)
+
 # Gather resource files (image/sound/etc) from res dir, list under "Other files"
 OTHER_FILES     *=  $$files(res/*, true)
 # Gather text files from root dir or anywhere recursively
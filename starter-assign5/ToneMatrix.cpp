@@ -6,65 +6,104 @@
  */
 
 #include "ToneMatrix.h"
+#include "SongStream.h"
 #include "Demos/DrawRectangle.h"
+#include "Demos/AudioSystem.h"
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 using namespace std;
 
 /* Color of a light that is off and that is on. */
 const Color kLightOffColor( 64,  64,  64);
 const Color kLightOnColor (250, 250, 100);
-const int PLUCK_STRING = 8192;
 
-/* Given a row index, returns the frequency of the note played by the
- * instrument at that index.
- *
- * For those of you who are musically inclined: the base frequency is
- * chosen to be a low C. The remaining notes are then repeated major
- * pentatonic scales stacked on top. To see why, note that one half step
- * corresponds to multiplying the frequency by the twelfth root of two.
- * Therefore, multiplying a frequency by pow(2, n / 12.0) corresponds
- * to taking the note n half-steps above the base frequency.
- *
- * Feel free to tinker and tweak these frequencies as an extension.
- * However, don't modify them when working on the base assignment;
- * our test cases make some assumptions based on how they work.
+/* How many light changes can be waiting for the audio thread, and how many
+ * retired layouts can be waiting for the GUI thread. Only sendLayout() sends
+ * layouts, and it empties the retired queue before each one, so the second
+ * number can be small. Before it runs again, only three layouts can come
+ * back. One is the layout the audio thread was still applying when the queue
+ * was emptied. Another is the layout that was waiting in the mailbox then.
+ * The last is the layout that was just sent.
  */
-double frequencyForRow(int rowIndex) {
-    if (rowIndex < 0) error("Invalid row index: " + to_string(rowIndex));
+const int kMaxLightChanges = 4096;
+const int kMaxRetired = 4;
 
-    /* Pentatonic note offsets from the base note, in number of
-     * half steps. Each row lowers the frequency, so we count
-     * down by the number of half steps.
-     */
-    const int kPentatonicSteps[] = {
-        0, -3, -5, -8, -10
-    };
+/* How many patterns of a song are got ready ahead of the one playing. */
+const int kSongPrefetch = 4;
+
+/* How many rows frequencyForRow() keeps a table of. */
+const int kTabulatedRows = 64;
 
-    /* High C. */
-    const double kBaseFrequency = 220 * pow(2, (30.0 + 9.0) / 12.0);
+/* Needs a definition since min() takes it by reference. */
+const int ToneMatrix::kConvertFrames;
 
-    /* Convert offset to how many octaves down to shift. */
-    int octave = rowIndex / 5;
+namespace {
+    /* Number of 64-bit words needed to hold one bit for each row. */
+    int wordsPerColumn(int rows) {
+        return (rows + 63) / 64;
+    }
+
+    /* Position of the lowest bit that's set in a nonzero word. */
+    int lowestSetBit(uint64_t bits) {
+    #if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return int(index);
+    #else
+        return __builtin_ctzll(bits);
+    #endif
+    }
 
-    /* Determine how many half steps we need to shift down. */
-    int halfSteps = (-(12 * octave) + kPentatonicSteps[rowIndex % 5]);
+    /* String banks are tuned with a few spare rows, so that growing the grid
+     * a little doesn't need a whole new set of strings.
+     */
+    int roomFor(int rows) {
+        return rows + max(4, rows / 8);
+    }
 
-    /* Each half step corresponds to scaling the frequency by the twelfth root of
-     * two. Therefore, taking a bunch of half steps down is equivalent to
-     * multiplying by some power of the twelfth root of two.
+    /* Float output goes to the sound card, which only accepts samples from
+     * -1 to +1, so it's clamped on the way out. Doubles are left alone.
      */
-    return kBaseFrequency * pow(2.0, halfSteps / 12.0);
+    inline void store(double& out, double sample) {
+        out = sample;
+    }
+
+    inline void store(float& out, double sample) {
+        out = clamp(float(sample), -1.0f, +1.0f);
+    }
+}
+
+/* Given a row index, returns the frequency of the note played by the
+ * instrument at that index in the usual pentatonic scale; see Scale for the
+ * details. The first few octaves are worked out once and then looked up, and
+ * rows beyond those are worked out as needed.
+ */
+double frequencyForRow(int rowIndex) {
+    if (rowIndex < 0) error("Invalid row index: " + to_string(rowIndex));
+
+    static const Scale kScale = Scale::pentatonic();
+    static const vector<double> kFrequencies = kScale.frequencies(kTabulatedRows);
+    if (rowIndex < kTabulatedRows) {
+        return kFrequencies[rowIndex];
+    }
+    return kScale.frequency(rowIndex);
 }
 
 
 /* The ToneMatrix function takes in a gridSize and a lightSize. The function
-* stores the state of each of the gridSize x gridSize lights, and initalizes
-* an array of StringInstruments.
+* stores the state of each of the gridSize x gridSize lights, and tunes one
+* string in the string bank for each row. The audio thread starts out with its
+* own copy of the (empty) grid.
 */
-ToneMatrix::ToneMatrix(int gridSize, int lightSize) {
+ToneMatrix::ToneMatrix(int gridSize, int lightSize)
+    : _scale(Scale::pentatonic()), _tuning(_scale, AudioSystem::sampleRate()),
+      _retired(kMaxRetired), _lightChanges(kMaxLightChanges) {
     _gridSize = gridSize;
     _lightSize = lightSize;
-    _instruments = new StringInstrument[_gridSize];
     _time = 0;
     _col = 0;
 
@@ -73,28 +112,60 @@ ToneMatrix::ToneMatrix(int gridSize, int lightSize) {
     for (int i = 0; i < _gridSize * _gridSize; i++){
         _grid[i] = false;
     }
+    _playSize = _gridSize;
+    _playWords = wordsPerColumn(_gridSize);
+    _playColumns = new uint64_t[_playSize * _playWords]();
+
+    // Every column starts out with the usual step length
+    _stepScales = new double[_gridSize];
+    _playStepScales = new double[_gridSize];
+    fill(_stepScales, _stepScales + _gridSize, 1.0);
+    fill(_playStepScales, _playStepScales + _gridSize, 1.0);
 
-    for (int j = 0; j < _gridSize; j++){
-        double freq = frequencyForRow(j);
-        // Create a string instrument and assign it to the array
-        // StringInstrument specificInstrument(freq);
-        _instruments[j] = StringInstrument(freq);
+    // Nothing has been drawn yet, so every light starts out dirty
+    _dirty = new bool[_gridSize * _gridSize]();
+    _dirtyCells = new int[_gridSize * _gridSize];
+
+    _rateVersion = AudioSystem::sampleRateVersion();
+    _strings = tuneStrings(_gridSize);
+    if (ParallelRenderer::partitionsFor(_gridSize) > 1) {
+        _parallel.startWorkers();
     }
 }
 
 /* The ToneMatrix destructor function cleans up all the memory allocated
- * by the ToneMatrix type.
+ * by the ToneMatrix type, including anything still in flight between the
+ * GUI thread and the audio thread. The audio must be stopped by this point.
  */
 ToneMatrix::~ToneMatrix() {
+    Layout* pending = _nextLayout.exchange(nullptr);
+    if (pending != nullptr) {
+        delete[] pending->columns;
+        delete[] pending->stepScales;
+        delete[] pending->periods;
+        delete pending->strings;
+        delete pending->song;
+        delete pending;
+    }
+    freeRetired();
+    delete _playSong;
+
     delete[] _grid;
-    delete[] _instruments;
+    delete[] _playColumns;
+    delete[] _stepScales;
+    delete[] _playStepScales;
+    delete[] _dirty;
+    delete[] _dirtyCells;
+    delete _strings;
 }
 
 /* The mousePressed function takes in two arguments: mouseX and mouseY.
  * Based on the location of the mouse, the function determines which light
- * in the grid the mouse was pressed on.
+ * in the grid the mouse was pressed on, and lets the audio thread know.
  */
 void ToneMatrix::mousePressed(int mouseX, int mouseY) {
+    retuneIfNeeded();
+
     // Converting mouseX and mouseY to grid coordinates
     int x = mouseX / _lightSize;
     int y = mouseY / _lightSize;
@@ -107,35 +178,90 @@ void ToneMatrix::mousePressed(int mouseX, int mouseY) {
         _grid[_gridSize * y + x] = false;
         _pressed = false;
     }
+    markDirty(_gridSize * y + x);
+    sendLight(_gridSize * y + x);
 }
 
 /* The mouseDragged function takes in two arguments: mouseX and mouseY,
  * indicating where the mouse was dragged within the Tone Matrix. The function
- * updates the state of the light directly under the mouse.
+ * updates the state of the light directly under the mouse. Dragging over a
+ * light that's already in the right state doesn't bother the audio thread.
  */
 void ToneMatrix::mouseDragged(int mouseX, int mouseY) {
     int x = mouseX / _lightSize;
     int y = mouseY / _lightSize;
-    _grid[_gridSize * y + x] = _pressed;
-
+    if (_grid[_gridSize * y + x] != _pressed) {
+        _grid[_gridSize * y + x] = _pressed;
+        markDirty(_gridSize * y + x);
+        sendLight(_gridSize * y + x);
+    }
 }
 
 /* The draw function draws the lights of the Tone Matrix, specifically computing
  * the rectangular bounding boxes for all the lights in the grid.
  */
 void ToneMatrix::draw() const {
+    // Send the lights off in batches rather than one at a time
+    RectangleBatch batch;
     for (int i = 0; i < _gridSize; i++){
         for (int j = 0; j < _gridSize; j++){
-            Rectangle rec = {i * _lightSize, j * _lightSize, _lightSize, _lightSize};
-            if (_grid[_gridSize * j + i]) {
-                drawRectangle(rec, kLightOnColor);
-            }
-            else if (!_grid[_gridSize * j + i]) {
-                drawRectangle(rec, kLightOffColor);
-            }
+            drawLight(batch, j, i);
+        }
+    }
+    batch.flush();
+}
+
+/* The drawDirty function draws just the lights that changed since it was last
+ * called, then forgets about them. If the whole grid is dirty it falls back on
+ * draw().
+ */
+void ToneMatrix::drawDirty() {
+    if (_allDirty) {
+        draw();
+    }
+    else {
+        RectangleBatch batch;
+        for (int k = 0; k < _dirtyCount; k++) {
+            int index = _dirtyCells[k];
+            drawLight(batch, index / _gridSize, index % _gridSize);
         }
+        batch.flush();
     }
 
+    // Everything on screen is now up to date
+    for (int k = 0; k < _dirtyCount; k++) {
+        _dirty[_dirtyCells[k]] = false;
+    }
+    _dirtyCount = 0;
+    _allDirty = false;
+}
+
+/* The markAllDirty function makes the next drawDirty() redraw every light. */
+void ToneMatrix::markAllDirty() {
+    _allDirty = true;
+}
+
+/* The drawLight function adds the light at the given row and column to a batch
+ * of rectangles to draw.
+ */
+void ToneMatrix::drawLight(RectangleBatch& batch, int row, int col) const {
+    Rectangle rec = {col * _lightSize, row * _lightSize, _lightSize, _lightSize};
+    if (_grid[_gridSize * row + col]) {
+        batch.add(rec, kLightOnColor);
+    }
+    else {
+        batch.add(rec, kLightOffColor);
+    }
+}
+
+/* The markDirty function notes that the light at the given index needs to be
+ * redrawn. Each light is only listed once.
+ */
+void ToneMatrix::markDirty(int index) {
+    if (!_allDirty && !_dirty[index]) {
+        _dirty[index] = true;
+        _dirtyCells[_dirtyCount++] = index;
+    }
 }
 
 /* The nextSample function determines whether it is time to pluck more strings
@@ -143,56 +269,147 @@ void ToneMatrix::draw() const {
  * by all the strings and sends that to the speakers.
  */
 Sample ToneMatrix::nextSample() {
-    Sample total = 0;
+    double total;
+    render(&total, 1);
+    return total;
+}
+
+
+/* The render function fills out with the next frames samples. It first picks up
+ * any edits from the GUI thread, then handles whatever events are due, and lets
+ * the string bank run every string over the whole stretch until the next event
+ * in one go.
+ */
+void ToneMatrix::render(double* out, int frames) {
+    renderAs(out, frames);
+}
+
+void ToneMatrix::render(float* out, int frames) {
+    renderAs(out, frames);
+}
 
-    // If the call is a multiple of 8192, pluck the string
-    if (_time % PLUCK_STRING == 0) {
-        for (int i = 0; i < _gridSize; i++) {
-            if (_grid[_gridSize * i + _col] == true) {
-                _instruments[i].pluck();
+
+/* The renderAs function does the work of render() for either output format. */
+template <typename T> void ToneMatrix::renderAs(T* out, int frames) {
+    applyPendingChanges();
+
+    while (frames > 0) {
+        // Handle everything that happens at this exact moment
+        EventScheduler::Event event;
+        while (_schedule.popEventAt(_time, event)) {
+            if (event.type == EventScheduler::EventType::TEMPO_CHANGE) {
+                _schedule.applyTempo();
+            }
+            else if (event.type == EventScheduler::EventType::PLUCK) {
+                pluckColumn(_col);
+            }
+            else {
+                // The step for the column we just played decides when the next one starts
+                _schedule.scheduleStep(_col, _playStepScales[_col]);
+                _col = (_col + 1) % _playSize;
+
+                // A song moves on to its next pattern as the sweep wraps around
+                if (_col == 0 && _playSong != nullptr) {
+                    playNextPattern();
+                }
             }
         }
-        _col = (_col + 1) % _gridSize;
+
+        // Nothing else happens until the next event
+        int span = int(min<int64_t>(frames, _schedule.nextEventTime() - _time));
+
+        // Run all the strings over the span and add up their samples
+        renderStrings(out, span);
+
+        _time += span;
+        out += span;
+        frames -= span;
     }
+}
 
-    _time++;
 
+/* The renderStrings function runs every string over the next frames samples.
+ * When out is in the strings' own format, they render straight into it, and
+ * float output is clamped by the bank as it goes.
+ */
+void ToneMatrix::renderStrings(EngineStrings::Value* out, int frames) {
+    _strings->render(out, frames, &_parallel, is_same<EngineStrings::Value, float>::value);
+}
 
-    // Loop through the rows and add up all the samples
-    for (int j = 0; j < _gridSize; j++){
-        total += _instruments[j].nextSample();
+/* Otherwise, they render into a scratch buffer a piece at a time, and the
+ * samples get converted (and clamped, if need be) on the way out.
+ */
+template <typename T> void ToneMatrix::renderStrings(T* out, int frames) {
+    while (frames > 0) {
+        int chunk = min(frames, kConvertFrames);
+        _strings->render(_converted, chunk, &_parallel);
+        for (int i = 0; i < chunk; i++) {
+            store(out[i], _converted[i]);
+        }
+        out += chunk;
+        frames -= chunk;
     }
-    return total;
+}
+
+
+/* The pluckColumn function plucks the strings whose lights are on in the given
+ * column, top row first.
+ */
+void ToneMatrix::pluckColumn(int col) {
+    const uint64_t* column = _playColumns + _playWords * col;
+    for (int w = 0; w < _playWords; w++) {
+        for (uint64_t bits = column[w]; bits != 0; bits &= bits - 1) {
+            // Rows can briefly lack a string just after a sample rate change
+            int row = 64 * w + lowestSetBit(bits);
+            if (row < _strings->size()) {
+                _strings->pluck(row);
+            }
+        }
+    }
+}
+
+
+/* The playNextPattern function switches the audio thread over to the next
+ * pattern of the song, which the song's own thread has already got ready. The
+ * arrays and strings it stops using go back to the song to be freed. If the
+ * next pattern isn't ready, the current one plays again.
+ */
+void ToneMatrix::playNextPattern() {
+    SongStream::Cue* cue = _playSong->next();
+    if (cue == nullptr) return;
+
+    cue->strings->copyStringsFrom(*_strings, min(_playSize, cue->size));
+    swap(_strings, cue->strings);
+    swap(_playColumns, cue->columns);
+    swap(_playStepScales, cue->stepScales);
+    swap(_playSize, cue->size);
+    _playWords = wordsPerColumn(_playSize);
+    _schedule.setTempo(cue->tempo);
+
+    _playSong->release(cue);
 }
 
 
 /* The resize function takes in a newGridSize and dynamically updates the tone matrix to a
- * new newGridSize x newGridSize. The function resizes both the light grid and the instrument array.
- * It also resets time and the playback position to behin at column 0.
+ * new newGridSize x newGridSize. The function resizes the light grid right away. If the
+ * audio thread's string bank has room for the new rows, it adds or drops strings in place;
+ * otherwise we build a new string bank for it to switch over to, and it carries the state
+ * of the old strings over. Either way, the audio thread resets time and the playback
+ * position to begin at column 0 when it picks up the change.
  */
 void ToneMatrix::resize(int newGridSize) {
     if (newGridSize <= 0) {
         error("This is not a valid grid size.");
     }
 
-    // Create a new, dynamically allocated array of StringInstruments of the new size
-    StringInstrument* _newInstruments = new StringInstrument[newGridSize];
-
-    // Resize the instruments array and copy over the old instruments to the new array
-    for (int i = 0; i < newGridSize; i++) {
-        if (i <= _gridSize - 1){
-            _newInstruments[i] = _instruments[i];
-        }
-        else {
-            double freq = frequencyForRow(i);
-            _newInstruments[i] = StringInstrument(freq);
-
-        }
+    // Only tune a fresh set of strings if the current ones can't stretch to fit
+    EngineStrings* strings = nullptr;
+    unsigned version = AudioSystem::sampleRateVersion();
+    if (newGridSize > _stringRoom || version != _rateVersion) {
+        strings = tuneStrings(newGridSize);
+        _rateVersion = version;
     }
 
-    delete [] _instruments;
-    _instruments = _newInstruments;
-
 
     // Resize the light grid
     bool* _newGrid = new bool[newGridSize * newGridSize];
@@ -202,44 +419,490 @@ void ToneMatrix::resize(int newGridSize) {
                 _newGrid[newGridSize * j + k] = _grid[_gridSize * j + k];
             }
             else {
-                _newGrid[newGridSize * j + k] == false;
+                _newGrid[newGridSize * j + k] = false;
             }
 
         }
     }
+    // Keep the step lengths of the columns that survive
+    double* stepScales = new double[newGridSize];
+    for (int col = 0; col < newGridSize; col++) {
+        stepScales[col] = col < _gridSize? _stepScales[col] : 1.0;
+    }
+    delete[] _stepScales;
+    _stepScales = stepScales;
+
     delete [] _grid;
     _grid = _newGrid;
-
-    _col = 0;
-    _time = 0;
     _gridSize = newGridSize;
 
+    // Every light has moved, so all of them need redrawing
+    delete[] _dirty;
+    delete[] _dirtyCells;
+    _dirty = new bool[_gridSize * _gridSize]();
+    _dirtyCells = new int[_gridSize * _gridSize];
+    _dirtyCount = 0;
+    _allDirty = true;
+
+    sendLayout(strings, true);
+}
+
+
+/* The setTempo function changes the speed of the sweep. The audio thread gets
+ * the new tempo along with a fresh copy of the grid, and switches over at the
+ * start of its next step.
+ */
+void ToneMatrix::setTempo(const Tempo& tempo) {
+    checkTempo(tempo);
+    _tempo = tempo;
+    sendLayout(nullptr, false);
+}
+
+
+/* The setScale function retunes every row to a new scale. The audio thread
+ * gets a fresh set of strings; the sweep carries on from where it was.
+ */
+void ToneMatrix::setScale(const Scale& scale) {
+    unsigned version = AudioSystem::sampleRateVersion();
+    EngineStrings* strings = tuneStrings(_gridSize, scale, _renderRate);
+    _scale = scale;
+    _rateVersion = version;
+    sendLayout(strings, false);
+}
+
+
+/* The scale function returns the scale the rows are tuned to. */
+const Scale& ToneMatrix::scale() const {
+    return _scale;
+}
+
+
+/* The setFractionalTuning function switches the strings between whole and
+ * fractional tuning. Strings keep ringing either way, since their lengths
+ * don't change, but they pick up their new tuning.
+ */
+void ToneMatrix::setFractionalTuning(bool enabled) {
+    if (enabled == _fractionalTuning) return;
+
+    _fractionalTuning = enabled;
+    unsigned version = AudioSystem::sampleRateVersion();
+    EngineStrings* strings = tuneStrings(_gridSize);
+    _rateVersion = version;
+    sendLayout(strings, false);
+}
+
+
+/* The fractionalTuning function returns whether strings are tuned to the
+ * fraction of a sample.
+ */
+bool ToneMatrix::fractionalTuning() const {
+    return _fractionalTuning;
+}
+
+
+/* The setRenderRate function changes the rate the matrix synthesizes at. The
+ * audio thread gets freshly tuned strings and starts counting its steps at the
+ * new rate.
+ */
+void ToneMatrix::setRenderRate(int rate) {
+    if (rate < 0) {
+        error("Render rate can't be negative.");
+    }
+    unsigned version = AudioSystem::sampleRateVersion();
+    EngineStrings* strings = tuneStrings(_gridSize, _scale, rate);
+    _renderRate = rate;
+    _rateVersion = version;
+    sendLayout(strings, false);
+}
+
+
+/* The renderRate function returns the rate the matrix synthesizes at. */
+int ToneMatrix::renderRate() const {
+    return _renderRate > 0? _renderRate : AudioSystem::sampleRate();
+}
+
+
+/* The loadPattern function swaps in a whole pattern at once. The grid is cleared
+ * and then only the lights that are on get touched, found a word at a time, so
+ * mostly empty patterns load in next to no time. The audio thread gets the
+ * pattern's words as they are, and new strings only if the scale changed or the
+ * grid outgrew the ones it has.
+ */
+void ToneMatrix::loadPattern(const PatternView& pattern) {
+    Tempo tempo = pattern.tempo();
+    checkTempo(tempo);
+    Scale scale = pattern.scale();
+    int size = pattern.size();
+
+    EngineStrings* strings = nullptr;
+    unsigned version = AudioSystem::sampleRateVersion();
+    if (size > _stringRoom || scale != _scale || version != _rateVersion) {
+        strings = tuneStrings(size, scale, _renderRate);
+        _scale = scale;
+        _rateVersion = version;
+    }
+
+    if (size != _gridSize) {
+        delete[] _grid;
+        delete[] _stepScales;
+        delete[] _dirty;
+        delete[] _dirtyCells;
+        _grid = new bool[size * size];
+        _stepScales = new double[size];
+        _dirty = new bool[size * size]();
+        _dirtyCells = new int[size * size];
+        _dirtyCount = 0;
+        _gridSize = size;
+    }
+    fill(_grid, _grid + size * size, false);
+    fill(_stepScales, _stepScales + size, 1.0);
+
+    const uint64_t* columns = pattern.columns();
+    int words = pattern.wordsPerColumn();
+    for (int col = 0; col < size; col++) {
+        for (int word = 0; word < words; word++) {
+            for (uint64_t bits = columns[words * col + word]; bits != 0; bits &= bits - 1) {
+                int row = 64 * word + lowestSetBit(bits);
+                if (row >= size) break;
+                _grid[size * row + col] = true;
+            }
+        }
+    }
+
+    _tempo = tempo;
+    _allDirty = true;
+    sendLayout(strings, true, columns);
 }
 
 
+/* The savePattern function adds the current state of the grid to a library. */
+void ToneMatrix::savePattern(PatternWriter& writer) const {
+    int index = writer.add(_gridSize, _tempo, _scale);
+    for (int row = 0; row < _gridSize; row++) {
+        for (int col = 0; col < _gridSize; col++) {
+            if (_grid[_gridSize * row + col]) {
+                writer.setLight(index, row, col, true);
+            }
+        }
+    }
+}
+
+
+/* The playSong function opens the song and gets its first few patterns ready,
+ * then hands it to the audio thread, which starts it from column 0.
+ */
+void ToneMatrix::playSong(const string& filename, bool loop) {
+    _song = new SongStream(filename, kSongPrefetch, renderRate(), _fractionalTuning, loop);
+    _songChanged = true;
+    sendLayout(nullptr, true);
+}
+
+
+/* The stopSong function hands the audio thread the grid back, along with
+ * strings tuned to the grid's scale, since the song's are tuned to its own.
+ */
+void ToneMatrix::stopSong() {
+    if (_song == nullptr) return;
 
+    _song = nullptr;
+    _songChanged = true;
+    _rateVersion = AudioSystem::sampleRateVersion();
+    sendLayout(tuneStrings(_gridSize), true);
+}
+
+
+/* The waitForSong function lets the song catch up, if there is one. */
+void ToneMatrix::waitForSong() {
+    if (_song != nullptr) {
+        _song->waitUntilReady();
+    }
+}
+
+
+/* The songPosition function asks the song which pattern it last handed over. */
+int ToneMatrix::songPosition() const {
+    return _song != nullptr? _song->position() : -1;
+}
+
+
+/* The setStepLength function stretches or squeezes one column's step. */
+void ToneMatrix::setStepLength(int col, double scale) {
+    if (col < 0 || col >= _gridSize) {
+        error("Column " + to_string(col) + " is out of range.");
+    }
+    if (scale <= 0) {
+        error("Step length scale must be positive.");
+    }
+    _stepScales[col] = scale;
+    sendLayout(nullptr, false);
+}
+
+
+/* The sendLight function tells the audio thread about the light at the given
+ * index. If the audio thread has fallen so far behind that there's no room for
+ * the message, we send it a copy of the whole grid instead.
+ */
+void ToneMatrix::sendLight(int index) {
+    freeRetired();
+
+    LightChange change;
+    change.index = index;
+    change.on = _grid[index];
+    change.generation = _generation;
+    if (!_lightChanges.push(change)) {
+        sendLayout(nullptr, false);
+    }
+}
+
+
+/* The sendLayout function hands a copy of the current grid, along with any new
+ * strings or song, over to the audio thread. If the audio thread hasn't picked up the
+ * previous layout yet, we take it back and fold it into this one. If columns is
+ * given, it's the grid already packed the way the audio thread wants it.
+ */
+void ToneMatrix::sendLayout(EngineStrings* strings, bool restart, const uint64_t* columns) {
+    freeRetired();
+
+    // Small grids never need the worker threads, so they're only started once
+    // the grid is big enough to split up. Songs can switch to a big pattern
+    // without the GUI thread hearing about it, so they start them up front.
+    if (ParallelRenderer::partitionsFor(_gridSize) > 1 || _song != nullptr) {
+        _parallel.startWorkers();
+    }
+
+    // Repack the grid column by column for the audio thread
+    int words = wordsPerColumn(_gridSize);
+    Layout* layout = new Layout;
+    layout->size = _gridSize;
+    layout->tempo = _tempo;
+    layout->renderRate = _renderRate;
+    layout->stepScales = new double[_gridSize];
+    copy(_stepScales, _stepScales + _gridSize, layout->stepScales);
+    layout->periods = new double[_gridSize];
+    for (int row = 0; row < _gridSize; row++) {
+        layout->periods[row] = _tuning.period(row);
+    }
+    layout->fractional = _fractionalTuning;
+    layout->columns = new uint64_t[_gridSize * words]();
+    if (columns != nullptr) {
+        copy(columns, columns + _gridSize * words, layout->columns);
+    }
+    else {
+        for (int row = 0; row < _gridSize; row++) {
+            for (int col = 0; col < _gridSize; col++) {
+                if (_grid[_gridSize * row + col]) {
+                    layout->columns[words * col + row / 64] |= uint64_t(1) << (row % 64);
+                }
+            }
+        }
+    }
+    layout->strings = strings;
+    layout->restart = restart;
+    layout->changeSong = _songChanged;
+    layout->song = _songChanged? _song : nullptr;
+    layout->generation = ++_generation;
+    _songChanged = false;
+
+    Layout* unseen = _nextLayout.exchange(nullptr, memory_order_acquire);
+    if (unseen != nullptr) {
+        // Keep its strings if we aren't replacing them
+        if (layout->strings == nullptr) {
+            layout->strings = unseen->strings;
+        }
+        else {
+            delete unseen->strings;
+        }
+        layout->restart = layout->restart || unseen->restart;
+
+        // Likewise its song, unless this layout brings a song of its own
+        if (unseen->changeSong && !layout->changeSong) {
+            layout->changeSong = true;
+            layout->song = unseen->song;
+        }
+        else {
+            delete unseen->song;
+        }
+        delete[] unseen->columns;
+        delete[] unseen->stepScales;
+        delete[] unseen->periods;
+        delete unseen;
+    }
+
+    _nextLayout.store(layout, memory_order_release);
+}
+
+
+/* The tuneStrings function builds a string bank with one string for each of
+ * the first count rows, tuned to the current scale for the current sample
+ * rate. The bank keeps room for a few more rows, which the audio thread can
+ * fill in without allocating.
+ */
+EngineStrings* ToneMatrix::tuneStrings(int count) {
+    return tuneStrings(count, _scale, _renderRate);
+}
+
+
+/* This version tunes to the given scale and render rate instead, so callers
+ * changing either can hold off on storing it until the strings are built.
+ */
+EngineStrings* ToneMatrix::tuneStrings(int count, const Scale& scale, int requestedRate) {
+    int room = roomFor(count);
+
+    // Only work the notes out again if the scale or sample rate changed. If a
+    // row can't be tuned, this reports an error before anything is changed.
+    int rate = requestedRate > 0? requestedRate : AudioSystem::sampleRate();
+    TuningTable tuning = _tuning.matches(scale, rate)? _tuning : TuningTable(scale, rate);
+    tuning.reserve(room);
+
+    EngineStrings* strings = new EngineStrings();
+    for (int i = 0; i < room; i++) {
+        // Add a string for this row to the bank
+        if (_fractionalTuning) {
+            strings->addPeriod(tuning.period(i));
+        }
+        else {
+            strings->addLength(tuning.length(i));
+        }
+    }
 
+    // Drop the spare rows' strings but keep their memory
+    strings->truncate(count);
 
+    _tuning = tuning;
+    _stringRoom = room;
+    return strings;
+}
 
 
+/* The retuneIfNeeded function checks whether the sample rate has changed since
+ * the strings were tuned. If so, it sends the audio thread a freshly tuned set
+ * of strings. The sweep carries on from where it was; strings whose length
+ * changed start out silent.
+ */
+void ToneMatrix::retuneIfNeeded() {
+    unsigned version = AudioSystem::sampleRateVersion();
+    if (version != _rateVersion) {
+        EngineStrings* strings = tuneStrings(_gridSize);
+        _rateVersion = version;
+        sendLayout(strings, false);
+    }
+}
 
 
+/* The freeRetired function frees whatever the audio thread has stopped using. */
+void ToneMatrix::freeRetired() {
+    Layout* retired;
+    while (_retired.pop(retired)) {
+        delete[] retired->columns;
+        delete[] retired->stepScales;
+        delete[] retired->periods;
+        delete retired->strings;
+        delete retired->song;
+        delete retired;
+    }
+}
 
 
+/* The applyPendingChanges function runs on the audio thread at the start of
+ * each block. It switches over to a new layout if there is one, then applies
+ * light changes meant for the layout it's now using. It never allocates or
+ * frees memory, and never waits on the GUI thread.
+ */
+void ToneMatrix::applyPendingChanges() {
+    Layout* layout = _nextLayout.exchange(nullptr, memory_order_acquire);
+    if (layout != nullptr) {
+        if (layout->changeSong) {
+            swap(_playSong, layout->song);
+        }
 
+        // While a song plays, the sweep is the song's; other layouts just go back
+        if (_playSong == nullptr || layout->changeSong) {
+            if (layout->strings != nullptr) {
+                layout->strings->copyStringsFrom(*_strings, min(_playSize, layout->size));
+                swap(_strings, layout->strings);
+            }
 
+            // Add or drop strings in place so there's one for each row. The bank
+            // always has room unless the sample rate changed since it was tuned;
+            // then the new rows stay silent until the strings are retuned.
+            if (_strings->size() > layout->size) {
+                _strings->truncate(layout->size);
+            }
+            for (int row = _strings->size(); row < layout->size; row++) {
+                bool added = layout->fractional? _strings->tryAddPeriod(layout->periods[row])
+                                               : _strings->tryAddLength(int(layout->periods[row]));
+                if (!added) break;
+            }
+            swap(_playColumns, layout->columns);
+            swap(_playStepScales, layout->stepScales);
+            swap(_playSize, layout->size);
+            _playWords = wordsPerColumn(_playSize);
+            _schedule.setTempo(layout->tempo);
+            _schedule.setSampleRate(layout->renderRate);
+
+            if (layout->restart) {
+                _col = 0;
+                _time = 0;
+                _schedule.restart();
+            }
+            else {
+                _col %= _playSize;
+            }
 
+            // A new song starts with its first pattern
+            if (_playSong != nullptr) {
+                playNextPattern();
+            }
+        }
 
+        // The layout now holds the old grid, strings, and song for the GUI to free
+        _playGeneration = layout->generation;
+        bool retired = _retired.push(layout);
+        assert(retired);
+        (void) retired;
+    }
+
+    LightChange change;
+    while (_lightChanges.peek(change)) {
+        // Changes made after a layout we haven't seen yet have to wait for it
+        if (change.generation > _playGeneration) break;
+
+        // Changes made before the current layout are already part of it, and
+        // changes made while a song plays aren't heard
+        if (change.generation == _playGeneration && _playSong == nullptr) {
+            int row = change.index / _playSize;
+            int col = change.index % _playSize;
+            uint64_t& word = _playColumns[_playWords * col + row / 64];
+            uint64_t bit = uint64_t(1) << (row % 64);
+            word = change.on? (word | bit) : (word & ~bit);
+        }
+        _lightChanges.pop(change);
+    }
+}
 
 
+/* The activeVoices function reports how many strings are awake. */
+int ToneMatrix::activeVoices() const {
+    return _strings->activeCount();
+}
 
 
+/* The isPlaying function reports whether the audio thread's copy of the grid
+ * has the light at the given row and column turned on.
+ */
+bool ToneMatrix::isPlaying(int row, int col) const {
+    return (_playColumns[_playWords * col + row / 64] >> (row % 64)) & 1;
+}
 
 
 /* * * * * Test Cases Below This Point * * * * */
 #include "GUI/SimpleTest.h"
 #include "Demos/AudioSystem.h"
 #include "GUI/TextUtils.h"
+#include "Demos/RectangleCatcher.h"
+#include "WaveformPool.h"
+#include <thread>
+#include <cstdio>
 
 STUDENT_TEST("Milestone 1: mousePressed toggles the light at row 0, col 0.") {
     AudioSystem::setSampleRate(44300);
@@ -426,6 +1089,635 @@ STUDENT_TEST("Milestone 4: Keeps track of the current column and how many more c
 
 }
 
+STUDENT_TEST("render() produces the same samples as repeated calls to nextSample().") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix bySample(8, 2);
+    ToneMatrix byBlock(8, 2);
+
+    /* Light up a diagonal so strings get plucked partway through blocks. */
+    for (int row = 0; row < 8; row++) {
+        bySample.mousePressed(2 * row + 1, 2 * row + 1);
+        byBlock.mousePressed(2 * row + 1, 2 * row + 1);
+    }
+
+    /* Use an awkward block size so block edges and pluck times don't line up. */
+    const int kBlockSize = 1000;
+    double block[kBlockSize];
+    for (int pass = 0; pass < 50; pass++) {
+        byBlock.render(block, kBlockSize);
+        for (int i = 0; i < kBlockSize; i++) {
+            EXPECT_EQUAL(Sample(block[i]), bySample.nextSample());
+        }
+    }
+    EXPECT_EQUAL(byBlock._col, bySample._col);
+    EXPECT_EQUAL(byBlock._time, bySample._time);
+}
+
+STUDENT_TEST("render() can produce floats for the sound card.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix byDouble(8, 1), byFloat(8, 1);
+    for (int i = 0; i < 8; i++) {
+        byDouble.mousePressed(i, (3 * i) % 8);
+        byFloat.mousePressed(i, (3 * i) % 8);
+    }
+
+    const int kBlockSize = 1000;
+    double expected[kBlockSize];
+    float block[kBlockSize];
+    for (int pass = 0; pass < 100; pass++) {
+        byDouble.render(expected, kBlockSize);
+        byFloat.render(block, kBlockSize);
+        for (int i = 0; i < kBlockSize; i++) {
+            EXPECT(fabs(block[i] - expected[i]) < 1e-6);
+        }
+    }
+
+    /* Thirty-two strings plucked at once add up to 1.6, which is too loud
+     * for the sound card, so the float samples get clamped.
+     */
+    ToneMatrix loud(32, 1), loudFloat(32, 1);
+    for (int row = 0; row < 32; row++) {
+        loud.mousePressed(0, row);
+        loudFloat.mousePressed(0, row);
+    }
+    loud.render(expected, 1);
+    loudFloat.render(block, 1);
+    EXPECT(fabs(expected[0] - 1.6) < 1e-6);
+    EXPECT_EQUAL(block[0], 1.0f);
+}
+
+STUDENT_TEST("Light changes reach the audio side at the next block, even if lots pile up.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(64, 1);
+
+    /* The GUI side sees the change right away; the audio side doesn't. */
+    matrix.mousePressed(0, 0);
+    EXPECT_EQUAL(matrix._grid[0], true);
+    EXPECT_EQUAL(matrix.isPlaying(0, 0), false);
+
+    matrix.applyPendingChanges();
+    EXPECT_EQUAL(matrix.isPlaying(0, 0), true);
+
+    /* Toggle every light twice over, which is far more changes than fit in the
+     * queue. The audio side should still end up with exactly the GUI's grid.
+     */
+    for (int round = 0; round < 2; round++) {
+        for (int row = 0; row < 64; row++) {
+            for (int col = 0; col < 64; col++) {
+                matrix.mousePressed(col, row);
+            }
+        }
+    }
+    matrix.mousePressed(5, 7);
+
+    matrix.applyPendingChanges();
+    for (int i = 0; i < 64 * 64; i++) {
+        EXPECT_EQUAL(matrix.isPlaying(i / 64, i % 64), matrix._grid[i]);
+    }
+}
+
+STUDENT_TEST("Editing and resizing while another thread renders is safe.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(16, 1);
+
+    /* Stand in for the audio thread. */
+    atomic<bool> done(false);
+    thread audio([&] {
+        double block[256];
+        while (!done) {
+            matrix.render(block, 256);
+        }
+    });
+
+    const int kSizes[] = { 4, 6, 8, 9, 12, 16, 18 };
+    for (int round = 0; round < 20; round++) {
+        int size = kSizes[round % 7];
+        matrix.resize(size);
+        for (int row = 0; row < size; row++) {
+            for (int col = 0; col < size; col++) {
+                matrix.mousePressed(col, row);
+            }
+        }
+    }
+
+    done = true;
+    audio.join();
+
+    /* Once the dust settles, the audio side matches the GUI side. */
+    matrix.applyPendingChanges();
+    EXPECT_EQUAL(matrix._playSize, matrix._gridSize);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    for (int i = 0; i < matrix._gridSize * matrix._gridSize; i++) {
+        EXPECT_EQUAL(matrix.isPlaying(i / matrix._gridSize, i % matrix._gridSize), matrix._grid[i]);
+    }
+}
+
+STUDENT_TEST("Changing the sample rate bumps its version and retunes the strings.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(8, 1);
+    unsigned before = AudioSystem::sampleRateVersion();
+
+    /* The rate can be read from any thread, without the GUI thread's help. */
+    int seen = 0;
+    thread reader([&] {
+        seen = AudioSystem::sampleRate();
+    });
+    reader.join();
+    EXPECT_EQUAL(seen, 44100);
+
+    AudioSystem::setSampleRate(22050);
+    unsigned version;
+    EXPECT_EQUAL(AudioSystem::sampleRate(version), 22050);
+    EXPECT_NOT_EQUAL(version, before);
+
+    /* The strings pick up the new rate the next time the grid is touched. */
+    matrix.mousePressed(0, 0);
+    matrix.applyPendingChanges();
+    for (int row = 0; row < 8; row++) {
+        EXPECT_EQUAL(matrix._strings->length(row), int(22050 / frequencyForRow(row)));
+    }
+    EXPECT_EQUAL(matrix.isPlaying(0, 0), true);
+
+    /* Polling picks up a change without the grid being touched. */
+    AudioSystem::setSampleRate(44100);
+    matrix.retuneIfNeeded();
+    matrix.applyPendingChanges();
+    for (int row = 0; row < 8; row++) {
+        EXPECT_EQUAL(matrix._strings->length(row), int(44100 / frequencyForRow(row)));
+    }
+    EXPECT_EQUAL(matrix.isPlaying(0, 0), true);
+}
+
+STUDENT_TEST("drawDirty() only redraws lights that changed.") {
+    AudioSystem::setSampleRate(44100);
+
+    const int lightSize = 10;
+    ToneMatrix matrix(8, lightSize);
+    RectangleCatcher catcher;
+
+    /* Nothing has been drawn yet, so the first call draws everything. */
+    matrix.drawDirty();
+    EXPECT_EQUAL(catcher.numDrawn(), 8 * 8);
+
+    /* With no changes, there's nothing to draw. */
+    catcher.reset();
+    matrix.drawDirty();
+    EXPECT_EQUAL(catcher.numDrawn(), 0);
+
+    /* Pressing a light redraws just that light. */
+    matrix.mousePressed(3 * lightSize + 1, 5 * lightSize + 1);
+    matrix.drawDirty();
+    EXPECT_EQUAL(catcher.numDrawn(), 1);
+    EXPECT_EQUAL(catcher[0].rectangle, Rectangle{ 3 * lightSize, 5 * lightSize, lightSize, lightSize });
+    EXPECT_EQUAL(catcher[0].color, kLightOnColor);
+
+    /* Dragging back and forth over the same lights lists each one once. */
+    catcher.reset();
+    matrix.mousePressed(0, 0);
+    for (int pass = 0; pass < 3; pass++) {
+        for (int col = 0; col < 4; col++) {
+            matrix.mouseDragged(col * lightSize + 1, 1);
+        }
+    }
+    matrix.drawDirty();
+    EXPECT_EQUAL(catcher.numDrawn(), 4);
+    for (int i = 0; i < catcher.numDrawn(); i++) {
+        EXPECT_EQUAL(catcher[i].color, kLightOnColor);
+    }
+
+    /* draw() still draws everything, and doesn't disturb the dirty lights. */
+    catcher.reset();
+    matrix.mousePressed(1, 1);
+    matrix.draw();
+    EXPECT_EQUAL(catcher.numDrawn(), 8 * 8);
+    catcher.reset();
+    matrix.drawDirty();
+    EXPECT_EQUAL(catcher.numDrawn(), 1);
+    EXPECT_EQUAL(catcher[0].color, kLightOffColor);
+
+    /* Resizing moves everything, so it's all dirty again. */
+    catcher.reset();
+    matrix.resize(6);
+    matrix.drawDirty();
+    EXPECT_EQUAL(catcher.numDrawn(), 6 * 6);
+
+    catcher.reset();
+    matrix.markAllDirty();
+    matrix.drawDirty();
+    EXPECT_EQUAL(catcher.numDrawn(), 6 * 6);
+}
+
+STUDENT_TEST("draw() sends rectangles in batches, but one-at-a-time drawing still works.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(16, 4);
+    matrix.mousePressed(0, 0);
+
+    /* Count batches as they come in. */
+    int batches = 0;
+    int total = 0;
+    setBatchDrawFunction([&](const Rectangle*, const Color* colors, int count) {
+        batches++;
+        total += count;
+        EXPECT_GREATER_THAN(count, 0);
+        EXPECT_EQUAL(colors[0], batches == 1? kLightOnColor : kLightOffColor);
+    });
+    matrix.draw();
+    EXPECT_EQUAL(total, 16 * 16);
+    EXPECT_LESS_THAN(batches, 16 * 16 / 8);
+
+    /* An old-style draw function sees every rectangle individually. */
+    int single = 0;
+    setDrawFunction([&](const Rectangle&, Color) {
+        single++;
+    });
+    matrix.draw();
+    EXPECT_EQUAL(single, 16 * 16);
+
+    setDrawFunction(nullptr);
+    EXPECT_ERROR(matrix.draw());
+}
+
+STUDENT_TEST("The audio side finds lights in rows past the first 64.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(70, 1);
+
+    /* One light in the first word of column 0, two in the second word of column 1. */
+    matrix.mousePressed(0, 3);
+    matrix.mousePressed(1, 64);
+    matrix.mousePressed(1, 69);
+    matrix.applyPendingChanges();
+
+    EXPECT_EQUAL(matrix._playWords, 2);
+    for (int row = 0; row < 70; row++) {
+        for (int col = 0; col < 70; col++) {
+            EXPECT_EQUAL(matrix.isPlaying(row, col), matrix._grid[70 * row + col]);
+        }
+    }
+
+    /* Column 0 plucks row 3 right away... */
+    double block[8192];
+    matrix.render(block, 1);
+    EXPECT_EQUAL(matrix._strings->activeCount(), 1);
+    EXPECT(matrix._strings->isAwake(3));
+
+    /* ...and column 1 plucks rows 64 and 69 at the start of the next step. */
+    matrix.render(block, 8192);
+    EXPECT_EQUAL(matrix._strings->activeCount(), 3);
+    EXPECT(matrix._strings->isAwake(64));
+    EXPECT(matrix._strings->isAwake(69));
+    EXPECT_EQUAL(matrix._strings->cursor(64), 1);
+
+    /* Turning a light off clears just its bit. */
+    matrix.mousePressed(1, 64);
+    matrix.applyPendingChanges();
+    EXPECT(!matrix.isPlaying(64, 1));
+    EXPECT(matrix.isPlaying(69, 1));
+}
+
+STUDENT_TEST("Worker threads only start once the grid is big enough to split up.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(16, 1);
+    matrix.resize(40);
+    EXPECT_EQUAL(matrix._parallel.workerCount(), 0);
+
+    matrix.resize(64);
+    EXPECT_EQUAL(matrix._parallel.workerCount(), ParallelRenderer::defaultWorkerCount());
+
+    ToneMatrix big(70, 1);
+    EXPECT_EQUAL(big._parallel.workerCount(), ParallelRenderer::defaultWorkerCount());
+}
+
+STUDENT_TEST("setTempo() and setStepLength() change when columns are plucked.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(4, 1);
+
+    /* Light up the top row so every column plucks string 0. */
+    for (int col = 0; col < 4; col++) {
+        matrix.mousePressed(col, 0);
+    }
+
+    /* 120 BPM in sixteenths is 5512.5 samples per step, and the second
+     * column is twice as long as the rest.
+     */
+    Tempo tempo;
+    tempo.bpm = 120;
+    matrix.setTempo(tempo);
+    matrix.setStepLength(1, 2.0);
+    matrix.resize(4);
+
+    /* Record when string 0 gets plucked. Right after a pluck, the cursor is at
+     * 1 and the sample there is still at full height.
+     */
+    Vector<int> plucks;
+    for (int time = 0; time < 5 * 5513; time++) {
+        matrix.nextSample();
+        if (matrix._strings->cursor(0) == 1 && Sample(matrix._strings->waveform(0)[1]) == Sample(0.05)) {
+            plucks += time;
+        }
+    }
+    EXPECT_EQUAL(plucks.size(), 5);
+    EXPECT_EQUAL(plucks[0], 0);
+    EXPECT_EQUAL(plucks[1], 5513);      // 5512.5, rounded
+    EXPECT_EQUAL(plucks[2], 16538);     // 5512.5 + 2 * 5512.5, rounded
+    EXPECT_EQUAL(plucks[3], 22050);     // No drift from rounding
+    EXPECT_EQUAL(plucks[4], 27563);     // Back around to column 0
+
+    EXPECT_ERROR(matrix.setStepLength(4, 1.0));
+    EXPECT_ERROR(matrix.setStepLength(0, 0.0));
+    tempo.swing = 1;
+    EXPECT_ERROR(matrix.setTempo(tempo));
+}
+
+STUDENT_TEST("Small resizes add and drop strings in place without new waveforms.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(16, 1);
+    matrix.mousePressed(0, 2);
+
+    double block[100];
+    matrix.render(block, 100);
+    EngineStrings* strings = matrix._strings;
+    const auto* waveform = strings->waveform(2);
+    EXPECT_EQUAL(strings->cursor(2), 100 % strings->length(2));
+
+    /* Growing from 16 to 18 rows fits in the room the bank already has. */
+    WaveformPool::Stats before = WaveformPool::stats();
+    matrix.resize(18);
+    matrix.applyPendingChanges();
+    EXPECT_EQUAL(WaveformPool::stats().heapAllocations, before.heapAllocations);
+    EXPECT_EQUAL(WaveformPool::stats().reusedAllocations, before.reusedAllocations);
+    EXPECT_EQUAL(matrix._strings, strings);
+    EXPECT_EQUAL(strings->size(), 18);
+    EXPECT_EQUAL(strings->waveform(2), waveform);
+    EXPECT_EQUAL(strings->cursor(2), 100 % strings->length(2));
+    for (int row = 0; row < 18; row++) {
+        EXPECT_EQUAL(strings->length(row), int(44100 / frequencyForRow(row)));
+    }
+
+    /* Shrinking never needs new strings. */
+    matrix.resize(5);
+    matrix.applyPendingChanges();
+    EXPECT_EQUAL(matrix._strings, strings);
+    EXPECT_EQUAL(strings->size(), 5);
+
+    /* Growing well past the spare room needs a new bank, which still picks
+     * up where the old strings left off.
+     */
+    matrix.resize(30);
+    matrix.applyPendingChanges();
+    EXPECT_NOT_EQUAL(matrix._strings, strings);
+    EXPECT_EQUAL(matrix._strings->size(), 30);
+    EXPECT_EQUAL(matrix._strings->cursor(2), 100 % matrix._strings->length(2));
+    EXPECT(matrix._strings->isAwake(2));
+
+    /* A resize past the notes that can be tuned changes nothing, so the
+     * next resize still knows how much room the strings really have.
+     */
+    EXPECT_ERROR(matrix.resize(200));
+    EXPECT_EQUAL(matrix._gridSize, 30);
+    matrix.resize(40);
+    matrix.applyPendingChanges();
+    EXPECT_EQUAL(matrix._strings->size(), 40);
+}
+
+STUDENT_TEST("setScale() retunes the rows from the tuning table.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(8, 1);
+    EXPECT(matrix.scale() == Scale::pentatonic());
+    EXPECT_EQUAL(matrix._tuning.length(7), int(44100 / frequencyForRow(7)));
+
+    /* Switch to half steps. Row 0 is the same note in both scales, so its
+     * string keeps ringing.
+     */
+    matrix.mousePressed(0, 0);
+    double block[100];
+    matrix.render(block, 100);
+    matrix.setScale(Scale::chromatic());
+    matrix.applyPendingChanges();
+    for (int row = 0; row < 8; row++) {
+        EXPECT_EQUAL(matrix._strings->length(row), int(44100 / Scale::chromatic().frequency(row)));
+    }
+    EXPECT(matrix._strings->isAwake(0));
+    EXPECT_EQUAL(matrix._strings->cursor(0), 100 % matrix._strings->length(0));
+
+    /* Rows added in place come from the same scale. */
+    matrix.resize(10);
+    matrix.applyPendingChanges();
+    for (int row = 0; row < 10; row++) {
+        EXPECT_EQUAL(matrix._strings->length(row), int(44100 / Scale::chromatic().frequency(row)));
+    }
+}
+
+STUDENT_TEST("setFractionalTuning() switches every row's string over.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(8, 1);
+    EXPECT(!matrix.fractionalTuning());
+    EXPECT(!matrix._strings->_fractional[0]);
+
+    /* Strings keep ringing through the switch, since their lengths match. */
+    matrix.mousePressed(0, 0);
+    double block[100];
+    matrix.render(block, 100);
+    matrix.setFractionalTuning(true);
+    matrix.applyPendingChanges();
+    for (int row = 0; row < 8; row++) {
+        EXPECT(matrix._strings->_fractional[row]);
+        EXPECT_EQUAL(matrix._strings->length(row), int(44100 / frequencyForRow(row)));
+    }
+    EXPECT(matrix._strings->isAwake(0));
+
+    /* Rows added in place are tuned the same way. */
+    matrix.resize(10);
+    matrix.applyPendingChanges();
+    EXPECT(matrix._strings->_fractional[9]);
+
+    matrix.setFractionalTuning(false);
+    matrix.applyPendingChanges();
+    EXPECT(!matrix._strings->_fractional[9]);
+
+    /* Switching retunes for the current sample rate, so there's nothing left
+     * for retuneIfNeeded() to do afterward.
+     */
+    AudioSystem::setSampleRate(48000);
+    matrix.setFractionalTuning(true);
+    matrix.applyPendingChanges();
+    EXPECT_EQUAL(matrix._strings->length(1), int(48000 / frequencyForRow(1)));
+    matrix.retuneIfNeeded();
+    EXPECT(matrix._nextLayout.load() == nullptr);
+    AudioSystem::setSampleRate(44100);
+}
+
+STUDENT_TEST("setRenderRate() retunes the strings and keeps the tempo in seconds.") {
+    AudioSystem::setSampleRate(44100);
+
+    ToneMatrix matrix(4, 1);
+    EXPECT_EQUAL(matrix.renderRate(), 44100);
+    for (int col = 0; col < 4; col++) {
+        matrix.mousePressed(col, 0);
+    }
+
+    /* At half the rate, strings are half as long and steps are 4096 samples. */
+    matrix.setRenderRate(22050);
+    EXPECT_EQUAL(matrix.renderRate(), 22050);
+    Vector<int> plucks;
+    for (int time = 0; time < 3 * 4096; time++) {
+        matrix.nextSample();
+        if (matrix._strings->cursor(0) == 1 && Sample(matrix._strings->waveform(0)[1]) == Sample(0.05)) {
+            plucks += time;
+        }
+    }
+    for (int row = 0; row < 4; row++) {
+        EXPECT_EQUAL(matrix._strings->length(row), int(22050 / frequencyForRow(row)));
+    }
+    EXPECT_EQUAL(plucks.size(), 3);
+    EXPECT_EQUAL(plucks[1], 4096);
+    EXPECT_EQUAL(plucks[2], 8192);
+
+    /* Zero goes back to the sound card's rate. */
+    matrix.setRenderRate(0);
+    matrix.applyPendingChanges();
+    EXPECT_EQUAL(matrix.renderRate(), 44100);
+    EXPECT_EQUAL(matrix._strings->length(0), int(44100 / frequencyForRow(0)));
+    EXPECT_ERROR(matrix.setRenderRate(-1));
+}
+
+STUDENT_TEST("loadPattern() and savePattern() swap whole patterns in and out.") {
+    AudioSystem::setSampleRate(44100);
+
+    Tempo fast;
+    fast.stepSamples = 1000;
+
+    PatternWriter writer;
+    writer.add(6, fast, Scale::chromatic());
+    writer.setLight(0, 2, 0, true);
+    writer.setLight(0, 5, 3, true);
+    writer.add(200, Tempo(), Scale::pentatonic());
+    writer.save("ToneMatrixPatternTest.tmpl");
+
+    {
+        PatternLibrary library("ToneMatrixPatternTest.tmpl");
+        ToneMatrix matrix(4, 1);
+        matrix.mousePressed(1, 1);
+        matrix.setStepLength(2, 3.0);
+        matrix.loadPattern(library.pattern(0));
+
+        /* The GUI side sees the new grid, tempo, and scale right away. */
+        EXPECT_EQUAL(matrix._gridSize, 6);
+        for (int index = 0; index < 36; index++) {
+            EXPECT_EQUAL(matrix._grid[index], index == 6 * 2 + 0 || index == 6 * 5 + 3);
+        }
+        EXPECT(matrix._tempo == fast);
+        EXPECT(matrix.scale() == Scale::chromatic());
+        EXPECT_EQUAL(matrix._stepScales[2], 1.0);
+
+        /* The audio side gets the pattern's words and strings for its scale. */
+        matrix.applyPendingChanges();
+        EXPECT_EQUAL(matrix._playSize, 6);
+        EXPECT_EQUAL(matrix._playColumns[0], uint64_t(1) << 2);
+        EXPECT_EQUAL(matrix._playColumns[3], uint64_t(1) << 5);
+        EXPECT_EQUAL(matrix._strings->length(1), int(44100 / Scale::chromatic().frequency(1)));
+
+        /* A pattern with more rows than can be tuned leaves everything as it
+         * was.
+         */
+        AudioSystem::setSampleRate(48000);
+        unsigned version = matrix._rateVersion;
+        EXPECT_ERROR(matrix.loadPattern(library.pattern(1)));
+        EXPECT_EQUAL(matrix._gridSize, 6);
+        EXPECT(matrix.scale() == Scale::chromatic());
+        EXPECT_EQUAL(matrix._rateVersion, version);
+        AudioSystem::setSampleRate(44100);
+
+        /* Saving it again gives back the same pattern. */
+        PatternWriter copy;
+        matrix.savePattern(copy);
+        copy.save("ToneMatrixPatternTest.tmpl");
+    }
+    {
+        PatternLibrary library("ToneMatrixPatternTest.tmpl");
+        PatternView pattern = library.pattern(0);
+        EXPECT_EQUAL(pattern.size(), 6);
+        EXPECT(pattern.isOn(2, 0));
+        EXPECT(pattern.isOn(5, 3));
+        EXPECT(!pattern.isOn(1, 1));
+        EXPECT(pattern.tempo() == fast);
+    }
+    remove("ToneMatrixPatternTest.tmpl");
+}
+
+STUDENT_TEST("playSong() moves on to the next pattern as the sweep wraps around.") {
+    AudioSystem::setSampleRate(44100);
+
+    Tempo first, second;
+    first.stepSamples = 10;
+    second.stepSamples = 20;
+
+    PatternWriter writer;
+    writer.add(4, first, Scale::chromatic());
+    writer.setLight(0, 0, 0, true);
+    writer.setLight(0, 3, 3, true);
+    writer.add(3, second, Scale::pentatonic());
+    writer.setLight(1, 2, 1, true);
+    writer.save("ToneMatrixSongTest.tmpl");
+
+    {
+        ToneMatrix matrix(5, 1);
+        EXPECT_EQUAL(matrix.songPosition(), -1);
+        matrix.playSong("ToneMatrixSongTest.tmpl");
+
+        /* The first pattern starts right away, at column 0. */
+        double block[40];
+        matrix.render(block, 1);
+        EXPECT_EQUAL(matrix.songPosition(), 0);
+        EXPECT_EQUAL(matrix._playSize, 4);
+        EXPECT_EQUAL(matrix._playColumns[0], uint64_t(1) << 0);
+        EXPECT_EQUAL(matrix._strings->length(1), int(44100 / Scale::chromatic().frequency(1)));
+        EXPECT(matrix._strings->isAwake(0));
+
+        /* Its last column is plucked at sample 30, and then the second
+         * pattern takes over, starting with the usual step before column 0.
+         */
+        matrix.render(block, 30);
+        EXPECT_EQUAL(matrix.songPosition(), 1);
+        EXPECT_EQUAL(matrix._playSize, 3);
+        EXPECT_EQUAL(matrix._col, 0);
+        EXPECT_EQUAL(matrix._strings->length(2), int(44100 / Scale::pentatonic().frequency(2)));
+
+        /* Edits to the grid aren't heard while the song plays. */
+        matrix.mousePressed(1, 1);
+        matrix.render(block, 29);
+        EXPECT(!matrix._strings->isAwake(2));
+        matrix.render(block, 1);
+        EXPECT(matrix._strings->isAwake(2));
+        EXPECT_EQUAL(matrix._playColumns[1], uint64_t(1) << 2);
+
+        /* The song is over, so its last pattern plays on. */
+        matrix.render(block, 40);
+        EXPECT_EQUAL(matrix._playSize, 3);
+        EXPECT_EQUAL(matrix._playSong->underruns(), 0);
+
+        /* Stopping it goes back to the grid. */
+        matrix.stopSong();
+        matrix.render(block, 1);
+        EXPECT_EQUAL(matrix.songPosition(), -1);
+        EXPECT(matrix._playSong == nullptr);
+        EXPECT_EQUAL(matrix._playSize, 5);
+        EXPECT_EQUAL(matrix._playColumns[1], uint64_t(1) << 1);
+    }
+    remove("ToneMatrixSongTest.tmpl");
+}
+
 PROVIDED_TEST("Milestone 1: ToneMatrix constructor stores the light dimensions.") {
     /* Other tests may have changed the sample rate. This is necessary to ensure that
      * the sample rate is set to a value large enough for all StringInstruments can
@@ -446,13 +1738,13 @@ PROVIDED_TEST("Milestone 1: ToneMatrix constructor sets instrument frequencies."
     AudioSystem::setSampleRate(44100);
 
     ToneMatrix matrix(16, 137);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
 
     /* Check that the frequencies are right by computing what they should be and comparing
      * against the expected value.
      */
     for (int i = 0; i < 16; i++) {
-        EXPECT_EQUAL(matrix._instruments[i]._length, AudioSystem::sampleRate() / frequencyForRow(i));
+        EXPECT_EQUAL(matrix._strings->length(i), AudioSystem::sampleRate() / frequencyForRow(i));
     }
 }
 
@@ -969,8 +2261,8 @@ PROVIDED_TEST("Milestone 4: First call to nextSample() plucks appropriate string
      */
     ToneMatrix matrix(16, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
 
     /* Press the lights in column 0 in all even-numbered rows. */
     for (int row = 0; row < 16; row += 2) {
@@ -988,8 +2280,8 @@ PROVIDED_TEST("Milestone 4: First call to nextSample() plucks appropriate string
      * the first sound sample in each instrument is 0.
      */
     for (int i = 0; i < 16; i++) {
-        EXPECT_EQUAL(matrix._instruments[i]._cursor, 0);
-        EXPECT_EQUAL(matrix._instruments[i]._waveform[0], 0);
+        EXPECT_EQUAL(matrix._strings->cursor(i), 0);
+        EXPECT_EQUAL(matrix._strings->waveform(i)[0], 0);
     }
 
     /* Get the next sample from the Tone Matrix. There are eight instruments
@@ -1002,17 +2294,17 @@ PROVIDED_TEST("Milestone 4: First call to nextSample() plucks appropriate string
      * position 1. The sample there should be equal to +0.05.
      */
     for (int row = 0; row < 16; row += 2) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], +0.05);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], +0.05);
     }
 
     /* Inspect the odd-numbered instruments. Their cursors should also have
      * moved forward to position 1, but all the entries should be 0.
      */
     for (int row = 1; row < 16; row += 2) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[0], 0.0);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], 0.0);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[0], 0.0);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], 0.0);
     }
 }
 
@@ -1024,8 +2316,8 @@ PROVIDED_TEST("Milestone 4: All strings are sampled at each step.") {
      */
     ToneMatrix matrix(16, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
 
     /* Press the lights in column 0 in all even-numbered rows. */
     for (int row = 0; row < 16; row += 2) {
@@ -1043,8 +2335,8 @@ PROVIDED_TEST("Milestone 4: All strings are sampled at each step.") {
      * the first sound sample in each instrument is 0.
      */
     for (int i = 0; i < 16; i++) {
-        EXPECT_EQUAL(matrix._instruments[i]._cursor, 0);
-        EXPECT_EQUAL(matrix._instruments[i]._waveform[0], 0);
+        EXPECT_EQUAL(matrix._strings->cursor(i), 0);
+        EXPECT_EQUAL(matrix._strings->waveform(i)[0], 0);
     }
 
     /* Get the next sample from the Tone Matrix. There are eight instruments
@@ -1057,17 +2349,17 @@ PROVIDED_TEST("Milestone 4: All strings are sampled at each step.") {
      * position 1. The sample there should be equal to +0.05.
      */
     for (int row = 0; row < 16; row += 2) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], +0.05);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], +0.05);
     }
 
     /* Inspect the odd-numbered instruments. Their cursors should also have
      * moved forward to position 1, but all the entries should be 0.
      */
     for (int row = 1; row < 16; row += 2) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[0], 0.0);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], 0.0);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[0], 0.0);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], 0.0);
     }
 
     /* Run ten time steps forward, ensuring all the cursors move. */
@@ -1075,7 +2367,7 @@ PROVIDED_TEST("Milestone 4: All strings are sampled at each step.") {
         matrix.nextSample();
 
         for (int row = 0; row < 16; row++) {
-            EXPECT_EQUAL(matrix._instruments[row]._cursor, i);
+            EXPECT_EQUAL(matrix._strings->cursor(row), i);
         }
     }
 }
@@ -1088,8 +2380,8 @@ PROVIDED_TEST("Milestone 4: The 8192nd call to nextSample() after the first pluc
      */
     ToneMatrix matrix(16, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
 
     /* Press the lights in column 1 in all even-numbered rows. */
     for (int row = 0; row < 16; row += 2) {
@@ -1114,8 +2406,8 @@ PROVIDED_TEST("Milestone 4: The 8192nd call to nextSample() after the first pluc
          * because nothing has been plucked yet.
          */
         for (int i = 0; i < 16; i++) {
-            int cursor = matrix._instruments[i]._cursor;
-            EXPECT_EQUAL(matrix._instruments[i]._waveform[cursor], 0);
+            int cursor = matrix._strings->cursor(i);
+            EXPECT_EQUAL(matrix._strings->waveform(i)[cursor], 0);
         }
     }
 
@@ -1140,16 +2432,16 @@ PROVIDED_TEST("Milestone 4: The 8192nd call to nextSample() after the first pluc
      * be +0.05.
      */
     for (int row = 0; row < 16; row += 2) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], +0.05);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], +0.05);
     }
 
     /* Inspect the odd-numbered instruments. The item under their cursors should
      * still be 0 because they haven't been plucked yet.
      */
     for (int row = 1; row < 16; row += 2) {
-        int cursor = matrix._instruments[row]._cursor;
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[cursor], 0.0);
+        int cursor = matrix._strings->cursor(row);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[cursor], 0.0);
     }
 }
 
@@ -1163,8 +2455,8 @@ PROVIDED_TEST("Milestone 4: Each instrument is plucked at the appropriate time."
      */
     ToneMatrix matrix(16, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
 
     /* Press the lights all the way down the main diagonal. This will cause each
      * instrument to be plucked when its column comes up.
@@ -1197,20 +2489,20 @@ PROVIDED_TEST("Milestone 4: Each instrument is plucked at the appropriate time."
             /* 'fabs' is "floating-point absolute value." It's basically
              * the absolute value function.
              */
-            int cursor = matrix._instruments[before]._cursor;
-            Sample amplitude = fabs(matrix._instruments[before]._waveform[cursor]);
+            int cursor = matrix._strings->cursor(before);
+            Sample amplitude = fabs(matrix._strings->waveform(before)[cursor]);
             EXPECT_LESS_THAN(amplitude, +0.05);
             EXPECT_GREATER_THAN(amplitude, -0.05);
         }
 
         /* Confirm instrument in row i is plucked. */
-        EXPECT_EQUAL(matrix._instruments[i]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[i]._waveform[1], +0.05);
+        EXPECT_EQUAL(matrix._strings->cursor(i), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(i)[1], +0.05);
 
         /* Nothing after us should be plucked. */
         for (int after = i + 1; after < 16; after++) {
-            int cursor = matrix._instruments[after]._cursor;
-            EXPECT_EQUAL(matrix._instruments[after]._waveform[cursor], 0.0);
+            int cursor = matrix._strings->cursor(after);
+            EXPECT_EQUAL(matrix._strings->waveform(after)[cursor], 0.0);
         }
 
         /* Advance time forward 8191 steps. */
@@ -1228,8 +2520,8 @@ PROVIDED_TEST("Milestone 4: nextSample() wraps back around to first column.") {
      */
     ToneMatrix matrix(16, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
 
     /* Set only the top-left light to on. */
     matrix.mousePressed(1, 1);
@@ -1244,8 +2536,8 @@ PROVIDED_TEST("Milestone 4: nextSample() wraps back around to first column.") {
                 EXPECT_EQUAL(matrix.nextSample(), +0.05);
 
                 /* First string should have been plucked. */
-                EXPECT_EQUAL(matrix._instruments[0]._cursor, 1);
-                EXPECT_EQUAL(matrix._instruments[0]._waveform[1], +0.05);
+                EXPECT_EQUAL(matrix._strings->cursor(0), 1);
+                EXPECT_EQUAL(matrix._strings->waveform(0)[1], +0.05);
             }
             /* Otherwise, nothing was plucked. We can't easily calculate what
              * the amplitude of the sample is.
@@ -1256,8 +2548,8 @@ PROVIDED_TEST("Milestone 4: nextSample() wraps back around to first column.") {
 
             /* No other strings should have been plucked. */
             for (int row = 1; row < 16; row++) {
-                int cursor = matrix._instruments[row]._cursor;
-                EXPECT_EQUAL(matrix._instruments[row]._waveform[cursor], 0.0);
+                int cursor = matrix._strings->cursor(row);
+                EXPECT_EQUAL(matrix._strings->waveform(row)[cursor], 0.0);
             }
 
             /* Move through 8191 more samples, which gets to the point where we are
@@ -1276,13 +2568,13 @@ PROVIDED_TEST("Milestone 5: resize() chooses instruments of correct frequencies.
     /* Initially, a 4x4 grid. */
     ToneMatrix matrix(4, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
     EXPECT_EQUAL(matrix._gridSize, 4);
     EXPECT_EQUAL(matrix._lightSize, 2);
 
     /* Check the existing frequencies. */
     for (int row = 0; row < 4; row++) {
-        EXPECT_EQUAL(matrix._instruments[row]._length, AudioSystem::sampleRate() / frequencyForRow(row));
+        EXPECT_EQUAL(matrix._strings->length(row), AudioSystem::sampleRate() / frequencyForRow(row));
     }
 
     /* Now expand up to 20 rows. */
@@ -1290,9 +2582,14 @@ PROVIDED_TEST("Milestone 5: resize() chooses instruments of correct frequencies.
     EXPECT_EQUAL(matrix._gridSize, 20);
     EXPECT_EQUAL(matrix._lightSize, 2); // Unchanged
 
+    /* The strings belong to the audio thread, which picks up the resize
+     * at the start of its next block. Do that now.
+     */
+    matrix.applyPendingChanges();
+
     /* Check the new frequencies. */
     for (int row = 0; row < 20; row++) {
-        EXPECT_EQUAL(matrix._instruments[row]._length, AudioSystem::sampleRate() / frequencyForRow(row));
+        EXPECT_EQUAL(matrix._strings->length(row), AudioSystem::sampleRate() / frequencyForRow(row));
     }
 
     /* Now resize back down to 3 instruments. */
@@ -1300,9 +2597,11 @@ PROVIDED_TEST("Milestone 5: resize() chooses instruments of correct frequencies.
     EXPECT_EQUAL(matrix._gridSize, 3);
     EXPECT_EQUAL(matrix._lightSize,     2); // Unchanged
 
+    matrix.applyPendingChanges();
+
     /* Check the new frequencies. */
     for (int row = 0; row < 3; row++) {
-        EXPECT_EQUAL(matrix._instruments[row]._length, AudioSystem::sampleRate() / frequencyForRow(row));
+        EXPECT_EQUAL(matrix._strings->length(row), AudioSystem::sampleRate() / frequencyForRow(row));
     }
 }
 
@@ -1314,8 +2613,8 @@ PROVIDED_TEST("Milestone 5: resize() preserves existing instruments.") {
      */
     ToneMatrix matrix(16, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
 
     /* Press the lights all the way down the first column. This will cause all
      * instruments to play on the first call to nextSample().
@@ -1338,8 +2637,8 @@ PROVIDED_TEST("Milestone 5: resize() preserves existing instruments.") {
      * by looking at the underlying waveforms.
      */
     for (int row = 0; row < 16; row++) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], +0.05);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], +0.05);
     }
 
     /* Now, resize the matrix down from 16 instruments to 8. This should
@@ -1349,12 +2648,14 @@ PROVIDED_TEST("Milestone 5: resize() preserves existing instruments.") {
     EXPECT_EQUAL(matrix._gridSize, 8);
     EXPECT_EQUAL(matrix._lightSize, 2);
 
+    matrix.applyPendingChanges();
+
     /* All instruments should have been plucked, which we can measure
      * by looking at the underlying waveforms.
      */
     for (int row = 0; row < 8; row++) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], +0.05);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], +0.05);
     }
 }
 
@@ -1366,8 +2667,8 @@ PROVIDED_TEST("Milestone 5: resize() extends existing instruments with new ones.
      */
     ToneMatrix matrix(8, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
 
     /* Press the lights all the way down the first column. This will cause all
      * instruments to play on the first call to nextSample().
@@ -1390,8 +2691,8 @@ PROVIDED_TEST("Milestone 5: resize() extends existing instruments with new ones.
      * by looking at the underlying waveforms.
      */
     for (int row = 0; row < 8; row++) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], +0.05);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], +0.05);
     }
 
     /* Now, resize the matrix up from 8 instruments to 15. This should leave
@@ -1401,16 +2702,18 @@ PROVIDED_TEST("Milestone 5: resize() extends existing instruments with new ones.
     EXPECT_EQUAL(matrix._gridSize, 15);
     EXPECT_EQUAL(matrix._lightSize, 2);
 
+    matrix.applyPendingChanges();
+
     /* First eight instruments should remain plucked. */
     for (int row = 0; row < 8; row++) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 1);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[1], +0.05);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 1);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[1], +0.05);
     }
 
     /* Next seven instruments should be unplucked. */
     for (int row = 8; row < 15; row++) {
-        EXPECT_EQUAL(matrix._instruments[row]._cursor, 0);
-        EXPECT_EQUAL(matrix._instruments[row]._waveform[0], 0.0);
+        EXPECT_EQUAL(matrix._strings->cursor(row), 0);
+        EXPECT_EQUAL(matrix._strings->waveform(row)[0], 0.0);
     }
 }
 
@@ -1419,8 +2722,8 @@ PROVIDED_TEST("Milestone 5: resize() preserves old lights when expanding.") {
 
     ToneMatrix matrix(2, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
     EXPECT_EQUAL(matrix._gridSize, 2);
 
     /* Turn every light in the grid on. The grid should now look like
@@ -1460,8 +2763,8 @@ PROVIDED_TEST("Milestone 5: resize() preserves old lights when contracting.") {
 
     ToneMatrix matrix(3, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
     EXPECT_EQUAL(matrix._gridSize, 3);
 
     /* Turn every light in the grid on. The grid should now look like
@@ -1495,8 +2798,8 @@ PROVIDED_TEST("Milestone 5: resize() resets the left-to-right sweep.") {
 
     ToneMatrix matrix(3, 2);
     EXPECT_NOT_EQUAL(matrix._grid, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments, nullptr);
-    EXPECT_NOT_EQUAL(matrix._instruments[0]._waveform, nullptr);
+    EXPECT_EQUAL(matrix._strings->size(), matrix._gridSize);
+    EXPECT_NOT_EQUAL(matrix._strings->waveform(0), nullptr);
     EXPECT_EQUAL(matrix._gridSize, 3);
 
     /* Turn on the lights in the second column. */
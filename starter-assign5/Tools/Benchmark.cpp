@@ -0,0 +1,311 @@
+/* File: Benchmark.cpp
+ *
+ * Measures how quickly the sound engine produces samples, so that we can tell
+ * how large a grid a machine can keep up with. Every case renders a fixed
+ * amount of audio and reports
+ *
+ *    ns_per_sample    Wall-clock time per output sample.
+ *    realtime_factor  Seconds of audio produced per second of work. Anything
+ *                     below 1 can't keep up with the sound card.
+ *    voices_per_core  Voices in the case times the real-time factor: roughly
+ *                     how many such voices one core could keep playing (or,
+ *                     for render_parallel, the whole machine).
+ *
+ * Usage:
+ *
+ *    Benchmark [--json] [--seconds N] [--quick]
+ *
+ *    --json          Print JSON instead of CSV.
+ *    --seconds N     Seconds of audio to render per case (default 5).
+ *    --quick         Only a handful of cases, for a fast sanity check.
+ */
+#include "ToneMatrix.h"
+#include "StringInstrument.h"
+#include "StringBank.h"
+#include "ParallelRenderer.h"
+#include "Demos/AudioSystem.h"
+#include "GUI/Timer.h"
+#include "error.h"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace {
+    const int kDefaultSeconds = 5;
+    const int kSampleRate     = 44100;
+
+    /* Matches the buffer the live audio system asks for. */
+    const int kBlockSize = 4000;
+
+    /* The Tone Matrix plucks a column this often. */
+    const int kPluckInterval = 8192;
+
+    const double kFrequencies[] = { 55, 110, 220, 440, 880, 1760, 3520 };
+    const int    kGridSizes[]   = { 4, 8, 16, 32, 64, 128, 256 };
+    const int    kVoiceCounts[] = { 4, 8, 16, 32, 64, 128, 256, 1024 };
+    const double kDensities[]   = { 0.0, 0.05, 0.25, 1.0 };
+
+    /* ToneMatrix rows keep dropping an octave every five rows, so very large
+     * grids have strings far too long to allocate. Skip those cases rather
+     * than run out of memory.
+     */
+    const double kMaxStringLength = 1 << 22;
+
+    struct Options {
+        bool json    = false;
+        bool quick   = false;
+        int  seconds = kDefaultSeconds;
+    };
+
+    struct Result {
+        string benchmark;   // What was timed
+        string path;        // "nextSample", "render", "render_float", or "render_parallel"
+        int    voices;      // Strings involved
+        double frequency;   // Hz, or 0 if there's a mix
+        double density;     // Fraction of lights on, or 0 if not a grid
+        long long samples;  // Output samples produced
+        double seconds;     // Time spent producing them
+    };
+
+    /* Runs the given work function, which produces samples samples, and
+     * records how long it took.
+     */
+    Result measure(Result result, const function<void ()>& work) {
+        Timing::Timer timer;
+        timer.start();
+        work();
+        timer.stop();
+        result.seconds = timer.elapsed();
+        return result;
+    }
+
+    /* Keeps the optimizer from throwing away samples we never look at. */
+    volatile double theSink;
+
+    template <typename T> void consume(const vector<T>& block) {
+        double total = 0;
+        for (T sample: block) total += sample;
+        theSink = theSink + total;
+    }
+
+    vector<Result> benchmarkStringInstrument(const Options& options) {
+        vector<Result> results;
+        long long samples = (long long)options.seconds * kSampleRate;
+
+        for (double frequency: kFrequencies) {
+            if (options.quick && frequency != 440) continue;
+
+            StringInstrument bySample(frequency);
+            bySample.pluck();
+            results.push_back(measure({ "StringInstrument", "nextSample", 1, frequency, 0, samples, 0 }, [&] {
+                double total = 0;
+                for (long long i = 0; i < samples; i++) {
+                    total += bySample.nextSample();
+                }
+                theSink = total;
+            }));
+
+            StringInstrument byBlock(frequency);
+            byBlock.pluck();
+            vector<double> block(kBlockSize);
+            results.push_back(measure({ "StringInstrument", "render", 1, frequency, 0, samples, 0 }, [&] {
+                for (long long done = 0; done < samples; done += kBlockSize) {
+                    int frames = int(min<long long>(kBlockSize, samples - done));
+                    byBlock.render(block.data(), frames, false);
+                }
+                consume(block);
+            }));
+        }
+        return results;
+    }
+
+    /* A bank where every string is plucked on every column, using the notes
+     * of the bottom five octaves of the Tone Matrix over and over. This shows
+     * what large numbers of voices cost regardless of how they're tuned.
+     */
+    template <typename Bank>
+    Result benchmarkBank(const string& path, int voices, long long samples, ParallelRenderer* renderer) {
+        Bank bank;
+        for (int i = 0; i < voices; i++) {
+            bank.add(frequencyForRow(i % 25));
+        }
+
+        vector<typename Bank::Value> block(kPluckInterval);
+        return measure({ "StringBank", path, voices, 0, 1.0, samples, 0 }, [&] {
+            for (long long done = 0; done < samples; done += kPluckInterval) {
+                for (int i = 0; i < voices; i++) {
+                    bank.pluck(i);
+                }
+                int frames = int(min<long long>(kPluckInterval, samples - done));
+                bank.render(block.data(), frames, renderer);
+            }
+            consume(block);
+        });
+    }
+
+    /* The render_float path uses single precision, and render_parallel spreads
+     * the bank over every core.
+     */
+    vector<Result> benchmarkStringBank(const Options& options) {
+        vector<Result> results;
+        long long samples = (long long)options.seconds * kSampleRate;
+        ParallelRenderer parallel;
+        parallel.startWorkers();
+
+        for (int voices: kVoiceCounts) {
+            if (options.quick && voices != 16) continue;
+
+            results.push_back(benchmarkBank<StringBank>("render", voices, samples, nullptr));
+            results.push_back(benchmarkBank<FloatStringBank>("render_float", voices, samples, nullptr));
+            results.push_back(benchmarkBank<StringBank>("render_parallel", voices, samples, &parallel));
+        }
+        return results;
+    }
+
+    /* Turns on each light with the given probability. The pattern is the
+     * same from run to run so results are comparable.
+     */
+    void randomPattern(ToneMatrix& matrix, int gridSize, double density) {
+        mt19937 generator(gridSize);
+        bernoulli_distribution on(density);
+        for (int row = 0; row < gridSize; row++) {
+            for (int col = 0; col < gridSize; col++) {
+                if (on(generator)) matrix.mousePressed(col, row);
+            }
+        }
+    }
+
+    vector<Result> benchmarkToneMatrix(const Options& options) {
+        vector<Result> results;
+        long long samples = (long long)options.seconds * kSampleRate;
+
+        for (int gridSize: kGridSizes) {
+            if (options.quick && gridSize != 16) continue;
+
+            if (kSampleRate / frequencyForRow(gridSize - 1) > kMaxStringLength) {
+                cerr << "Skipping " << gridSize << "x" << gridSize << " Tone Matrix: "
+                     << "its lowest string would need "
+                     << kSampleRate / frequencyForRow(gridSize - 1) << " samples." << endl;
+                continue;
+            }
+
+            for (double density: kDensities) {
+                if (options.quick && density != 0.25) continue;
+
+                ToneMatrix bySample(gridSize, 1);
+                randomPattern(bySample, gridSize, density);
+                results.push_back(measure({ "ToneMatrix", "nextSample", gridSize, 0, density, samples, 0 }, [&] {
+                    double total = 0;
+                    for (long long i = 0; i < samples; i++) {
+                        total += bySample.nextSample();
+                    }
+                    theSink = total;
+                }));
+
+                ToneMatrix byBlock(gridSize, 1);
+                randomPattern(byBlock, gridSize, density);
+                vector<double> block(kBlockSize);
+                results.push_back(measure({ "ToneMatrix", "render", gridSize, 0, density, samples, 0 }, [&] {
+                    for (long long done = 0; done < samples; done += kBlockSize) {
+                        int frames = int(min<long long>(kBlockSize, samples - done));
+                        byBlock.render(block.data(), frames);
+                    }
+                    consume(block);
+                }));
+            }
+        }
+        return results;
+    }
+
+    double nsPerSample(const Result& result) {
+        return result.seconds * 1e9 / result.samples;
+    }
+
+    double realTimeFactor(const Result& result) {
+        double audio = double(result.samples) / kSampleRate;
+        return result.seconds > 0? audio / result.seconds : 0;
+    }
+
+    void printCSV(const vector<Result>& results) {
+        cout << "benchmark,path,voices,frequency,density,samples,seconds,"
+                "ns_per_sample,realtime_factor,voices_per_core" << endl;
+        for (const Result& result: results) {
+            cout << result.benchmark << ","
+                 << result.path << ","
+                 << result.voices << ","
+                 << result.frequency << ","
+                 << result.density << ","
+                 << result.samples << ","
+                 << result.seconds << ","
+                 << nsPerSample(result) << ","
+                 << realTimeFactor(result) << ","
+                 << result.voices * realTimeFactor(result) << endl;
+        }
+    }
+
+    void printJSON(const vector<Result>& results) {
+        cout << "[" << endl;
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& result = results[i];
+            cout << "  { \"benchmark\": \"" << result.benchmark << "\""
+                 << ", \"path\": \"" << result.path << "\""
+                 << ", \"voices\": " << result.voices
+                 << ", \"frequency\": " << result.frequency
+                 << ", \"density\": " << result.density
+                 << ", \"samples\": " << result.samples
+                 << ", \"seconds\": " << result.seconds
+                 << ", \"ns_per_sample\": " << nsPerSample(result)
+                 << ", \"realtime_factor\": " << realTimeFactor(result)
+                 << ", \"voices_per_core\": " << result.voices * realTimeFactor(result)
+                 << " }" << (i + 1 < results.size()? "," : "") << endl;
+        }
+        cout << "]" << endl;
+    }
+
+    Options parseOptions(int argc, char* argv[]) {
+        Options result;
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--json") {
+                result.json = true;
+            } else if (arg == "--quick") {
+                result.quick = true;
+            } else if (arg == "--seconds" && i + 1 < argc) {
+                result.seconds = atoi(argv[++i]);
+                if (result.seconds <= 0) error("Value for --seconds must be a positive integer.");
+            } else {
+                error("Usage: Benchmark [--json] [--seconds N] [--quick]");
+            }
+        }
+        return result;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        Options options = parseOptions(argc, argv);
+        AudioSystem::setSampleRate(kSampleRate);
+
+        vector<Result> results;
+        for (auto benchmark: { benchmarkStringInstrument, benchmarkStringBank, benchmarkToneMatrix }) {
+            vector<Result> more = benchmark(options);
+            results.insert(results.end(), more.begin(), more.end());
+        }
+
+        cout << setprecision(6);
+        if (options.json) {
+            printJSON(results);
+        } else {
+            printCSV(results);
+        }
+        return 0;
+    } catch (const ErrorException& e) {
+        cerr << "Error: " << e.getMessage() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,57 @@
+###############################################################################
+# Sound engine sources shared by the command-line tools in this directory.
+# These are the pieces of the Tone Matrix that don't need a window or a sound
+# card. Include this from a tool's .pro file.
+###############################################################################
+
+ENGINE_ROOT = $$PWD/..
+
+# "qmake CONFIG+=float32" builds the engine in single precision, as in
+# Tone Matrix.pro.
+float32: DEFINES += TONE_MATRIX_FLOAT32
+
+SOURCES     +=  $$ENGINE_ROOT/ToneMatrix.cpp \
+                $$ENGINE_ROOT/StringBank.cpp \
+                $$ENGINE_ROOT/ParallelRenderer.cpp \
+                $$ENGINE_ROOT/EventScheduler.cpp \
+                $$ENGINE_ROOT/StringInstrument.cpp \
+                $$ENGINE_ROOT/Tuning.cpp \
+                $$ENGINE_ROOT/PatternLibrary.cpp \
+                $$ENGINE_ROOT/SongStream.cpp \
+                $$ENGINE_ROOT/WaveformPool.cpp \
+                $$ENGINE_ROOT/KarplusStrong.cpp \
+                $$ENGINE_ROOT/Demos/Sample.cpp \
+                $$ENGINE_ROOT/Demos/DrawRectangle.cpp \
+                $$ENGINE_ROOT/Demos/Rectangle.cpp \
+                $$ENGINE_ROOT/Demos/RectangleCatcher.cpp \
+                $$ENGINE_ROOT/GUI/Color.cpp \
+                $$ENGINE_ROOT/GUI/MemoryDiagnostics.cpp \
+                $$ENGINE_ROOT/GUI/SimpleTest.cpp \
+                $$ENGINE_ROOT/GUI/TextUtils.cpp
+
+HEADERS     +=  $$ENGINE_ROOT/ToneMatrix.h \
+                $$ENGINE_ROOT/StringBank.h \
+                $$ENGINE_ROOT/ParallelRenderer.h \
+                $$ENGINE_ROOT/EventScheduler.h \
+                $$ENGINE_ROOT/StringInstrument.h \
+                $$ENGINE_ROOT/Tuning.h \
+                $$ENGINE_ROOT/PatternLibrary.h \
+                $$ENGINE_ROOT/SongStream.h \
+                $$ENGINE_ROOT/WaveformPool.h \
+                $$ENGINE_ROOT/KarplusStrong.h \
+                $$ENGINE_ROOT/Demos/Sample.h \
+                $$ENGINE_ROOT/Demos/SPSCQueue.h
+
+# The tools never start Qt's audio, so they link the sample rate, buffering,
+# and metrics storage in Demos/SampleRate.cpp, Demos/AudioBuffering.cpp, and
+# Demos/AudioMetrics.cpp, and the resampler in Demos/Resampler.cpp, without
+# the rest of Demos/AudioSystem.cpp.
+# AudioSystem.h is deliberately left out of HEADERS so that moc doesn't
+# generate code for the parts of AudioSystem that need a sound card.
+SOURCES     +=  $$ENGINE_ROOT/Demos/SampleRate.cpp \
+                $$ENGINE_ROOT/Demos/AudioBuffering.cpp \
+                $$ENGINE_ROOT/Demos/AudioMetrics.cpp \
+                $$ENGINE_ROOT/Demos/Resampler.cpp
+HEADERS     +=  $$ENGINE_ROOT/Demos/AudioBuffering.h \
+                $$ENGINE_ROOT/Demos/AudioMetrics.h \
+                $$ENGINE_ROOT/Demos/Resampler.h
@@ -0,0 +1,279 @@
+/* File: HeadlessRender.cpp
+ *
+ * Command-line driver that renders a Tone Matrix pattern straight into a .wav
+ * file, without opening a window or touching the sound card. This makes it
+ * possible to listen to, diff, or profile the sound engine on machines that
+ * have no audio device at all.
+ *
+ * Usage:
+ *
+ *    HeadlessRender pattern.txt output.wav [options]
+ *    HeadlessRender library.tmpl output.wav [--pattern N] [options]
+ *    HeadlessRender library.tmpl output.wav --song [--loop] [options]
+ *
+ *    --seconds N     How many seconds of audio to render (default 10).
+ *    --rate R        Sample rate in Hz (default 44100).
+ *    --render-rate R Synthesize at R Hz and resample to the output rate
+ *                    (default: synthesize at the output rate).
+ *    --block N       Samples rendered per call to ToneMatrix::render (default 4000).
+ *    --pcm16         Write 16-bit integer samples instead of 32-bit float.
+ *    --metrics       Print callback timing histograms and voice counts, as
+ *                    the live overlay would show them, after rendering.
+ *    --pattern N     Which pattern of a pattern library to render, counting
+ *                    from 0 (default 0).
+ *    --song          Play every pattern of a pattern library in order, each
+ *                    one taking over when the sweep wraps around.
+ *    --loop          Start the song over after its last pattern.
+ *
+ * A pattern file is a square grid of characters, one row per line. An X or a 1
+ * is a light that's on, and a . or a 0 is a light that's off. Blank lines and
+ * lines starting with # are ignored. A pattern library (see PatternLibrary.h)
+ * is recognized by its header, and brings its own tempo and scale.
+ */
+#include "ToneMatrix.h"
+#include "PatternLibrary.h"
+#include "Demos/AudioSystem.h"
+#include "Demos/AudioBuffering.h"
+#include "Demos/AudioMetrics.h"
+#include "Demos/Resampler.h"
+#include "Tools/WavWriter.h"
+#include "GUI/Timer.h"
+#include "error.h"
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace {
+    const int kDefaultSeconds    = 10;
+    const int kDefaultSampleRate = 44100;
+    const int kDefaultBlockSize  = 4000;   // Matches the live audio buffer.
+
+    struct Options {
+        string patternFile;
+        string outputFile;
+        int seconds    = kDefaultSeconds;
+        int sampleRate = kDefaultSampleRate;
+        int renderRate = 0;
+        int pattern    = 0;
+        int blockSize  = kDefaultBlockSize;
+        WavWriter::Format format = WavWriter::Format::FLOAT32;
+        bool metrics = false;
+        bool song = false;
+        bool loop = false;
+    };
+
+    /* Parses a positive integer option value. */
+    int positiveInteger(const string& option, const string& value) {
+        size_t used;
+        int result;
+        try {
+            result = stoi(value, &used);
+        } catch (const exception&) {
+            error("Value for " + option + " must be an integer.");
+        }
+        if (used != value.size() || result <= 0) {
+            error("Value for " + option + " must be a positive integer.");
+        }
+        return result;
+    }
+
+    Options parseOptions(int argc, char* argv[]) {
+        Options result;
+        vector<string> positional;
+
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--pcm16") {
+                result.format = WavWriter::Format::PCM16;
+            } else if (arg == "--metrics") {
+                result.metrics = true;
+            } else if (arg == "--song") {
+                result.song = true;
+            } else if (arg == "--loop") {
+                result.loop = true;
+            } else if (arg == "--pattern") {
+                if (i + 1 == argc) error("Missing value for " + arg + ".");
+                string value = argv[++i];
+                result.pattern = value == "0"? 0 : positiveInteger(arg, value);
+            } else if (arg == "--seconds" || arg == "--rate" || arg == "--render-rate" || arg == "--block") {
+                if (i + 1 == argc) error("Missing value for " + arg + ".");
+                int value = positiveInteger(arg, argv[++i]);
+                if      (arg == "--seconds")     result.seconds    = value;
+                else if (arg == "--rate")        result.sampleRate = value;
+                else if (arg == "--render-rate") result.renderRate = value;
+                else                             result.blockSize  = value;
+            } else if (arg.size() > 1 && arg[0] == '-') {
+                error("Unknown option " + arg + ".");
+            } else {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() != 2) {
+            error("Usage: HeadlessRender pattern.txt output.wav "
+                  "[--seconds N] [--rate R] [--render-rate R] [--block N] [--pcm16] [--metrics] [--pattern N] [--song] [--loop]");
+        }
+        result.patternFile = positional[0];
+        result.outputFile  = positional[1];
+        return result;
+    }
+
+    /* Reads a pattern file into a list of rows, confirming that it's square. */
+    vector<string> readPattern(const string& filename) {
+        ifstream input(filename);
+        if (!input) error("Cannot open pattern file " + filename + ".");
+
+        vector<string> rows;
+        for (string line; getline(input, line); ) {
+            /* Tolerate files saved with Windows line endings. */
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty() || line[0] == '#') continue;
+
+            for (char ch: line) {
+                if (ch != 'X' && ch != 'x' && ch != '1' && ch != '.' && ch != '0') {
+                    error("Unexpected character '" + string(1, ch) + "' in pattern file.");
+                }
+            }
+            rows.push_back(line);
+        }
+
+        if (rows.empty()) error("Pattern file " + filename + " is empty.");
+        for (const string& row: rows) {
+            if (row.size() != rows.size()) {
+                error("Pattern must be square; found a row of length " +
+                      to_string(row.size()) + " in a " + to_string(rows.size()) + "-row pattern.");
+            }
+        }
+        return rows;
+    }
+
+    /* Whether the file starts the way a pattern library does. */
+    bool isPatternLibrary(const string& filename) {
+        ifstream input(filename, ios::binary);
+        char magic[sizeof(PatternFormat::kMagic)];
+        return input.read(magic, sizeof(magic)) && memcmp(magic, PatternFormat::kMagic, sizeof(magic)) == 0;
+    }
+
+    /* Turns on the lights in the matrix that are on in the pattern. With a
+     * light size of one, mouse coordinates are exactly grid coordinates.
+     */
+    void loadPattern(ToneMatrix& matrix, const vector<string>& rows) {
+        for (size_t row = 0; row < rows.size(); row++) {
+            for (size_t col = 0; col < rows[row].size(); col++) {
+                char ch = rows[row][col];
+                if (ch == 'X' || ch == 'x' || ch == '1') {
+                    matrix.mousePressed(col, row);
+                }
+            }
+        }
+    }
+
+    void renderToFile(const Options& options) {
+        AudioSystem::setSampleRate(options.sampleRate);
+
+        /* A library's pattern is copied into the matrix, so the library
+         * doesn't need to stay open.
+         */
+        unique_ptr<ToneMatrix> engine;
+        int gridSize;
+        if (isPatternLibrary(options.patternFile)) {
+            PatternLibrary library(options.patternFile);
+            PatternView pattern = library.pattern(options.pattern);
+            gridSize = pattern.size();
+            engine.reset(new ToneMatrix(gridSize, 1));
+            engine->loadPattern(pattern);
+        } else {
+            if (options.song) error("Only a pattern library can be played as a song.");
+            vector<string> rows = readPattern(options.patternFile);
+            gridSize = int(rows.size());
+            engine.reset(new ToneMatrix(gridSize, 1));
+            loadPattern(*engine, rows);
+        }
+        ToneMatrix& matrix = *engine;
+
+        /* At a render rate of its own, the matrix renders floats into a
+         * resampler, just as it would for the sound card.
+         */
+        unique_ptr<Resampler> resampler;
+        vector<float> resampled;
+        if (options.renderRate > 0 && options.renderRate != options.sampleRate) {
+            matrix.setRenderRate(options.renderRate);
+            resampler.reset(new Resampler([&](float* out, int frames) {
+                matrix.render(out, frames);
+                AudioMetrics::recordVoices(matrix.activeVoices());
+            }, options.renderRate, options.sampleRate));
+            resampled.resize(options.blockSize);
+        }
+
+        /* A song is tuned for the render rate, so it starts once that's set. */
+        if (options.song) {
+            matrix.playSong(options.patternFile, options.loop);
+        }
+
+        WavWriter output(options.outputFile, options.sampleRate, options.format);
+        vector<double> block(options.blockSize);
+
+        int64_t total = int64_t(options.seconds) * options.sampleRate;
+        Timing::Timer renderTime;
+        AudioMetrics::reset();
+
+        for (int64_t done = 0; done < total; ) {
+            int frames = int(min<int64_t>(options.blockSize, total - done));
+
+            /* Only the engine is timed, not the file I/O. Each block is
+             * measured against the time it would take to play, just as the
+             * live audio callbacks are.
+             */
+            double before = renderTime.elapsed();
+
+            /* Rendering runs ahead of real time, and a song has to keep up. */
+            matrix.waitForSong();
+            renderTime.start();
+            if (resampler) {
+                resampler->render(resampled.data(), frames);
+                copy(resampled.begin(), resampled.begin() + frames, block.begin());
+            } else {
+                matrix.render(block.data(), frames);
+                AudioMetrics::recordVoices(matrix.activeVoices());
+            }
+            renderTime.stop();
+            AudioBuffering::noteCallback(frames, renderTime.elapsed() - before);
+            AudioMetrics::recordDelivery(frames, frames);
+
+            output.write(block.data(), frames);
+            done += frames;
+        }
+        output.close();
+
+        double elapsed = renderTime.elapsed();
+        cout << "Rendered " << options.seconds << " second(s) of a "
+             << gridSize << "x" << gridSize << " grid to "
+             << options.outputFile << endl;
+        cout << "Render time: " << elapsed << "s";
+        if (elapsed > 0) {
+            cout << " (" << options.seconds / elapsed << "x real time)";
+        }
+        cout << endl;
+        if (options.song) {
+            cout << "Song ended on pattern " << matrix.songPosition() << endl;
+        }
+
+        if (options.metrics) {
+            cout << AudioMetrics::report(AudioMetrics::snapshot()) << endl;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        renderToFile(parseOptions(argc, argv));
+        return 0;
+    } catch (const ErrorException& e) {
+        cerr << "Error: " << e.getMessage() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,47 @@
+###############################################################################
+# Shared settings for the command-line tools in this directory. Each tool's
+# .pro file (next to Tone Matrix.pro) sets TARGET and its own SOURCES, then
+# includes this.
+###############################################################################
+
+SPL_VERSION = 2024.1
+
+TEMPLATE    =   app
+QT          +=  core
+QT          -=  gui
+CONFIG      +=  console silent debug
+CONFIG      -=  app_bundle depend_includepath
+
+###############################################################################
+#       Find/use installed version of cs106 lib and headers                   #
+###############################################################################
+
+win32|win64     { QTP_EXE = qtpaths.exe } else { QTP_EXE = qtpaths }
+USER_DATA_DIR   =   $$system($$[QT_INSTALL_BINS]/$$QTP_EXE --writable-path GenericDataLocation)
+SPL_DIR         =   $${USER_DATA_DIR}/cs106
+
+LIBS            +=  -lcs106 -lpthread
+QMAKE_LFLAGS    =   -L$$shell_quote($${SPL_DIR}/lib)
+INCLUDEPATH     +=  $$PWD/.. "$${SPL_DIR}/include"
+DEPENDPATH      +=  $$PWD/..
+
+DESTDIR     =   $$PWD/..
+
+# Unlike the GUI program, the tools supply their own real main(), so there
+# is no main=qMain rename here.
+
+include(Engine.pri)
+
+###############################################################################
+#       Configure compiler, compile flags                                     #
+###############################################################################
+
+CONFIG      +=  sdk_no_version_check c++17
+
+QMAKE_CXXFLAGS_WARN_ON      +=  -Werror=return-type
+QMAKE_CXXFLAGS_WARN_ON      +=  -Werror=uninitialized
+QMAKE_CXXFLAGS_WARN_ON      +=  -Wunused-parameter
+QMAKE_CXXFLAGS_WARN_ON      +=  -Wno-sign-compare
+
+# Timings reported by the tools are only meaningful with optimization on.
+QMAKE_CXXFLAGS_DEBUG        +=  -O2
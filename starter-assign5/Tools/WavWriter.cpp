@@ -0,0 +1,119 @@
+#include "WavWriter.h"
+#include "error.h"
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+namespace {
+    /* WAV files are little-endian no matter what machine we're on. */
+    void putLE(char* dest, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            dest[i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+        }
+    }
+
+    /* Format tags from the WAV spec. */
+    const uint16_t kFormatPCM   = 1;
+    const uint16_t kFormatFloat = 3;
+
+    /* Size of the RIFF + fmt + data headers we write. */
+    const int kHeaderSize = 44;
+}
+
+/* write() hands this to min(), so it has to live somewhere. */
+const int WavWriter::kChunkSize;
+
+WavWriter::WavWriter(const string& filename, int sampleRate, Format format)
+    : out(filename, ios::binary), sampleRate(sampleRate), format(format) {
+    if (!out) {
+        error("Cannot open " + filename + " for writing.");
+    }
+
+    /* Write a placeholder header; close() fills in the sizes. */
+    writeHeader();
+}
+
+/* The destructor can run while an error from write() is unwinding the stack,
+ * so it never reports errors of its own. If the stream has already failed,
+ * the header isn't worth rewriting.
+ */
+WavWriter::~WavWriter() {
+    if (!out.is_open()) return;
+
+    if (out) {
+        try {
+            close();
+            return;
+        } catch (const ErrorException&) {
+            // Fall through and just let go of the file
+        }
+    }
+    out.close();
+}
+
+void WavWriter::write(const double* samples, int count) {
+    while (count > 0) {
+        int batch = min(count, kChunkSize);
+        int bytes;
+
+        if (format == Format::FLOAT32) {
+            for (int i = 0; i < batch; i++) {
+                float value = clamp(static_cast<float>(samples[i]), -1.0f, +1.0f);
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                putLE(chunk + 4 * i, bits, 4);
+            }
+            bytes = 4 * batch;
+        } else {
+            for (int i = 0; i < batch; i++) {
+                double value = clamp(samples[i], -1.0, +1.0);
+                int16_t quantized = static_cast<int16_t>(value * 32767.0);
+                putLE(chunk + 2 * i, static_cast<uint16_t>(quantized), 2);
+            }
+            bytes = 2 * batch;
+        }
+
+        out.write(chunk, bytes);
+        if (!out) error("Error writing WAV data.");
+
+        written += batch;
+        samples += batch;
+        count   -= batch;
+    }
+}
+
+void WavWriter::close() {
+    out.seekp(0);
+    writeHeader();
+    out.close();
+}
+
+int64_t WavWriter::samplesWritten() const {
+    return written;
+}
+
+/* Writes the 44-byte header for a mono file, using however many samples
+ * have been written so far as the data size.
+ */
+void WavWriter::writeHeader() {
+    int bytesPerSample = (format == Format::FLOAT32)? 4 : 2;
+    uint32_t dataBytes = static_cast<uint32_t>(written * bytesPerSample);
+
+    char header[kHeaderSize];
+    memcpy(header +  0, "RIFF", 4);
+    putLE (header +  4, kHeaderSize - 8 + dataBytes, 4);
+    memcpy(header +  8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    putLE (header + 16, 16, 4);                                   // fmt chunk size
+    putLE (header + 20, format == Format::FLOAT32? kFormatFloat : kFormatPCM, 2);
+    putLE (header + 22, 1, 2);                                    // Mono
+    putLE (header + 24, sampleRate, 4);
+    putLE (header + 28, sampleRate * bytesPerSample, 4);          // Bytes per second
+    putLE (header + 32, bytesPerSample, 2);                       // Block align
+    putLE (header + 34, 8 * bytesPerSample, 2);                   // Bits per sample
+    memcpy(header + 36, "data", 4);
+    putLE (header + 40, dataBytes, 4);
+
+    out.write(header, kHeaderSize);
+    if (!out) error("Error writing WAV header.");
+}
@@ -0,0 +1,56 @@
+/* File: WavWriter.h
+ *
+ * Streams mono audio into a .wav file a chunk at a time, so that arbitrarily
+ * long renders never need to be held in memory.
+ */
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <cstdint>
+
+class WavWriter {
+public:
+    /* Sample formats we know how to write. */
+    enum class Format {
+        FLOAT32, // IEEE 32-bit float
+        PCM16    // Signed 16-bit integer
+    };
+
+    /* Opens the given file for writing. Reports an error if the file can't
+     * be created.
+     */
+    WavWriter(const std::string& filename, int sampleRate, Format format);
+
+    /* Finishes the file if close() hasn't been called yet. Unlike close(),
+     * this never reports an error; call close() to find out whether the file
+     * was finished properly.
+     */
+    ~WavWriter();
+
+    /* Appends samples to the file. Samples are clamped to [-1, +1]. */
+    void write(const double* samples, int count);
+
+    /* Fills in the header with the final sizes and closes the file. Reports
+     * an error if the header can't be written.
+     */
+    void close();
+
+    /* How many samples have been written so far. */
+    std::int64_t samplesWritten() const;
+
+    WavWriter(const WavWriter&) = delete;
+    void operator= (const WavWriter&) = delete;
+
+private:
+    std::ofstream out;
+    int sampleRate;
+    Format format;
+    std::int64_t written = 0;
+
+    /* Samples are converted into this buffer before being written out. */
+    static const int kChunkSize = 4096;
+    char chunk[kChunkSize * sizeof(float)];
+
+    void writeHeader();
+};
@@ -0,0 +1,214 @@
+/* File: Tuning.cpp
+ *
+ * Implementation of the Scale and TuningTable types.
+ */
+#include "Tuning.h"
+#include "error.h"
+#include <climits>
+#include <cmath>
+#include <string>
+using namespace std;
+
+namespace {
+    /* High C, the top note of the usual Tone Matrix. */
+    const double kHighC = 220 * pow(2, (30.0 + 9.0) / 12.0);
+}
+
+Scale::Scale(double baseFrequency, const vector<double>& cents, double periodCents) {
+    if (!(baseFrequency > 0)) {
+        error("Base frequency must be positive.");
+    }
+    if (cents.empty()) {
+        error("A scale needs at least one note.");
+    }
+    _baseFrequency = baseFrequency;
+    _cents = cents;
+    _periodCents = periodCents;
+}
+
+/* For those of you who are musically inclined: the base frequency is chosen
+ * to be a high C, and the remaining notes are repeated major pentatonic scales
+ * stacked below it. One half step is a hundred cents, and corresponds to
+ * multiplying the frequency by the twelfth root of two, so pow(2, n / 1200.0)
+ * takes a note n cents up.
+ *
+ * Feel free to tinker and tweak these frequencies as an extension. However,
+ * don't modify them when working on the base assignment; our test cases make
+ * some assumptions based on how they work.
+ */
+Scale Scale::pentatonic() {
+    return Scale(kHighC, { 0, -300, -500, -800, -1000 });
+}
+
+Scale Scale::chromatic() {
+    vector<double> cents;
+    for (int step = 0; step < 12; step++) {
+        cents.push_back(-100.0 * step);
+    }
+    return Scale(kHighC, cents);
+}
+
+/* With whole numbers of cents, as in the built-in scales, the exponent here
+ * comes out exactly as (half steps) / 12, so the frequencies are the same to
+ * the last bit as if they'd been worked out in half steps.
+ */
+double Scale::frequency(int row) const {
+    if (row < 0) error("Invalid row index: " + to_string(row));
+
+    int notes  = int(_cents.size());
+    int repeat = row / notes;
+    double cents = _cents[row % notes] - _periodCents * repeat;
+    return _baseFrequency * pow(2.0, cents / 1200.0);
+}
+
+vector<double> Scale::frequencies(int rows) const {
+    vector<double> result;
+    for (int row = 0; row < rows; row++) {
+        result.push_back(frequency(row));
+    }
+    return result;
+}
+
+double Scale::baseFrequency() const {
+    return _baseFrequency;
+}
+
+const vector<double>& Scale::cents() const {
+    return _cents;
+}
+
+double Scale::periodCents() const {
+    return _periodCents;
+}
+
+bool Scale::operator== (const Scale& rhs) const {
+    return _baseFrequency == rhs._baseFrequency &&
+           _cents         == rhs._cents &&
+           _periodCents   == rhs._periodCents;
+}
+
+bool Scale::operator!= (const Scale& rhs) const {
+    return !(*this == rhs);
+}
+
+TuningTable::TuningTable(const Scale& scale, int sampleRate) : _scale(scale) {
+    if (sampleRate <= 0) {
+        error("Sample rate must be positive.");
+    }
+    _sampleRate = sampleRate;
+}
+
+/* Lengths are truncated, just as StringBank::add() truncates them. */
+void TuningTable::reserve(int rows) {
+    for (int row = int(_frequencies.size()); row < rows; row++) {
+        double frequency = _scale.frequency(row);
+        double period = _sampleRate / frequency;
+        if (!(frequency < _sampleRate) || period >= INT_MAX) {
+            error("Row " + to_string(row) + " plays a note that can't be tuned at " +
+                  to_string(_sampleRate) + "Hz.");
+        }
+        _frequencies.push_back(frequency);
+        _periods.push_back(period);
+        _lengths.push_back(int(period));
+    }
+}
+
+double TuningTable::frequency(int row) const {
+    checkRow(row);
+    return _frequencies[row];
+}
+
+double TuningTable::period(int row) const {
+    checkRow(row);
+    return _periods[row];
+}
+
+int TuningTable::length(int row) const {
+    checkRow(row);
+    return _lengths[row];
+}
+
+int TuningTable::rows() const {
+    return int(_frequencies.size());
+}
+
+int TuningTable::sampleRate() const {
+    return _sampleRate;
+}
+
+const Scale& TuningTable::scale() const {
+    return _scale;
+}
+
+bool TuningTable::matches(const Scale& scale, int sampleRate) const {
+    return _sampleRate == sampleRate && _scale == scale;
+}
+
+void TuningTable::checkRow(int row) const {
+    if (row < 0 || row >= rows()) {
+        error("Row " + to_string(row) + " isn't in the tuning table.");
+    }
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include "GUI/SimpleTest.h"
+
+STUDENT_TEST("Built-in scales descend in the expected steps.") {
+    Scale pentatonic = Scale::pentatonic();
+    EXPECT(fabs(pentatonic.frequency(0) - 2093.004522) < 1e-6);
+    EXPECT(fabs(pentatonic.frequency(5) - pentatonic.frequency(0) / 2) < 1e-9);
+    EXPECT(fabs(pentatonic.frequency(1) / pentatonic.frequency(0) - pow(2, -3 / 12.0)) < 1e-12);
+
+    Scale chromatic = Scale::chromatic();
+    EXPECT_EQUAL(chromatic.frequency(0), pentatonic.frequency(0));
+    EXPECT(fabs(chromatic.frequency(12) - chromatic.frequency(0) / 2) < 1e-9);
+    EXPECT(fabs(chromatic.frequency(1) / chromatic.frequency(0) - pow(2, -1 / 12.0)) < 1e-12);
+
+    EXPECT(pentatonic != chromatic);
+    EXPECT(pentatonic == Scale::pentatonic());
+    EXPECT_ERROR(pentatonic.frequency(-1));
+}
+
+STUDENT_TEST("Arbitrary scales repeat over their period.") {
+    /* A whole-tone scale that repeats every fifth instead of every octave. */
+    Scale scale(1000, { 0, -200, -400 }, 700);
+    EXPECT_EQUAL(scale.frequency(0), 1000);
+    EXPECT(fabs(scale.frequency(3) - 1000 * pow(2, -700 / 1200.0)) < 1e-9);
+    EXPECT(fabs(scale.frequency(5) - 1000 * pow(2, -1100 / 1200.0)) < 1e-9);
+
+    EXPECT_ERROR(Scale(1000, {}));
+    EXPECT_ERROR(Scale(0, { 0 }));
+}
+
+STUDENT_TEST("TuningTable agrees with working out each row from scratch.") {
+    TuningTable table(Scale::pentatonic(), 44100);
+    EXPECT_EQUAL(table.rows(), 0);
+    EXPECT_ERROR(table.length(0));
+
+    table.reserve(30);
+    EXPECT_EQUAL(table.rows(), 30);
+    for (int row = 0; row < 30; row++) {
+        EXPECT_EQUAL(table.frequency(row), Scale::pentatonic().frequency(row));
+        EXPECT_EQUAL(table.period(row), 44100 / Scale::pentatonic().frequency(row));
+        EXPECT_EQUAL(table.length(row), int(44100 / Scale::pentatonic().frequency(row)));
+    }
+
+    /* Reserving fewer rows keeps the ones already there. */
+    table.reserve(10);
+    EXPECT_EQUAL(table.rows(), 30);
+
+    EXPECT(table.matches(Scale::pentatonic(), 44100));
+    EXPECT(!table.matches(Scale::pentatonic(), 48000));
+    EXPECT(!table.matches(Scale::chromatic(), 44100));
+}
+
+STUDENT_TEST("TuningTable refuses notes that can't be played.") {
+    /* Too high for the sample rate. */
+    TuningTable high(Scale(50000, { 0 }), 44100);
+    EXPECT_ERROR(high.reserve(1));
+
+    /* So low the string would be longer than an int can count. */
+    TuningTable low(Scale::pentatonic(), 44100);
+    EXPECT_ERROR(low.reserve(200));
+}
@@ -0,0 +1,86 @@
+/* File: Tuning.h
+ *
+ * Scales, and tables that map the rows of a Tone Matrix to the notes of a
+ * scale. A Scale describes which notes there are; a TuningTable works out,
+ * once, the frequency of each row and the length of the string that plays
+ * it at a given sample rate, so that tuning strings afterward is just a
+ * matter of looking them up.
+ */
+#pragma once
+
+#include <vector>
+
+class Scale {
+public:
+    /* Creates a scale starting at the given frequency. The first row plays
+     * the base frequency shifted by the first offset in cents, the second row
+     * by the second offset, and so on. After the last offset, the pattern
+     * repeats, shifted down by periodCents. Offsets are usually zero or
+     * negative, so that rows further down play lower notes.
+     */
+    Scale(double baseFrequency, const std::vector<double>& cents, double periodCents = 1200);
+
+    /* The Tone Matrix's usual scale: major pentatonic, descending from a
+     * high C. This is the scale frequencyForRow() uses.
+     */
+    static Scale pentatonic();
+
+    /* Every half step, descending from the same high C. */
+    static Scale chromatic();
+
+    /* The frequency, in Hz, of the note for the given row. This works it
+     * out from scratch; TuningTable remembers the answers.
+     */
+    double frequency(int row) const;
+
+    /* Frequencies of the first rows notes. */
+    std::vector<double> frequencies(int rows) const;
+
+    /* The values the scale was created with. */
+    double baseFrequency() const;
+    const std::vector<double>& cents() const;
+    double periodCents() const;
+
+    bool operator== (const Scale& rhs) const;
+    bool operator!= (const Scale& rhs) const;
+
+private:
+    double _baseFrequency;
+    std::vector<double> _cents;
+    double _periodCents;
+};
+
+class TuningTable {
+public:
+    /* Creates an empty table for the given scale and sample rate. */
+    TuningTable(const Scale& scale, int sampleRate);
+
+    /* Makes sure the table covers at least the first rows rows. Reports an
+     * error if one of them can't be played at this sample rate.
+     */
+    void reserve(int rows);
+
+    /* Frequency of, and length of the string for, the given row, which must
+     * be one the table covers. The period is how many samples one cycle of
+     * the note lasts, fraction and all; the length is that rounded down.
+     */
+    double frequency(int row) const;
+    double period(int row) const;
+    int length(int row) const;
+
+    int rows() const;
+    int sampleRate() const;
+    const Scale& scale() const;
+
+    /* Whether this table is for the given scale and sample rate. */
+    bool matches(const Scale& scale, int sampleRate) const;
+
+private:
+    Scale _scale;
+    int _sampleRate;
+    std::vector<double> _frequencies;
+    std::vector<double> _periods;
+    std::vector<int> _lengths;
+
+    void checkRow(int row) const;
+};
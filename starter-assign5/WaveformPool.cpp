@@ -0,0 +1,268 @@
+/* File: WaveformPool.cpp
+ *
+ * Implementation of the WaveformPool functions, and of the hook that sends
+ * Sample arrays through the pool.
+ *
+ * Size classes go up in quarter steps between powers of two (64, 80, 96, 112,
+ * 128, 160, ...), so a block is never more than 25% bigger than what was asked
+ * for. Every block starts with a small header recording its size class, and
+ * freed blocks are threaded onto the free list for that class through their
+ * headers.
+ */
+#include "WaveformPool.h"
+#include "Demos/Sample.h"
+#include <mutex>
+#include <new>
+using namespace std;
+
+namespace {
+    /* Sizes of the classes, in bytes of payload. */
+    const size_t kSmallestClass = 64;
+    const int kStepsPerDoubling = 4;
+    const int kNumClasses       = 22 * kStepsPerDoubling;  // Up to about 200MB
+
+    /* The free lists hold at most this much of any one class, and this much
+     * in all, so one huge grid doesn't leave its waveforms cached for good.
+     * Blocks bigger than the per-class limit always go back to the heap.
+     */
+    const size_t kMaxCachedPerClass = size_t(16) << 20;
+    const size_t kMaxCachedBytes    = size_t(64) << 20;
+
+    /* Sits in front of every block. It's padded out so the payload after it
+     * is as aligned as anything new would return.
+     */
+    struct alignas(alignof(max_align_t)) Header {
+        Header* next;   // Next free block in the class, while on a free list
+        int sizeClass;  // Or kNumClasses if it came straight from the heap
+    };
+
+    size_t classSize(int sizeClass) {
+        size_t base = kSmallestClass << (sizeClass / kStepsPerDoubling);
+        return base + base / kStepsPerDoubling * (sizeClass % kStepsPerDoubling);
+    }
+
+    /* Smallest class that fits the given number of bytes, or kNumClasses if
+     * none does.
+     */
+    int classFor(size_t bytes) {
+        int sizeClass = 0;
+        while (sizeClass < kNumClasses && classSize(sizeClass) < bytes) {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    struct Pool {
+        mutex lock;
+        Header* freeLists[kNumClasses] = {};
+        size_t cached[kNumClasses] = {};   // Bytes on each free list
+        WaveformPool::Stats stats = {};
+    };
+
+    /* Built on first use so that it's ready for Samples in other files'
+     * static initializers.
+     */
+    Pool& pool() {
+        static Pool instance;
+        return instance;
+    }
+
+    Header* headerOf(void* memory) {
+        return static_cast<Header*>(memory) - 1;
+    }
+}
+
+namespace WaveformPool {
+    void* allocate(size_t bytes) {
+        int sizeClass = classFor(bytes);
+
+        if (sizeClass < kNumClasses) {
+            Pool& p = pool();
+            lock_guard<mutex> guard(p.lock);
+            Header* block = p.freeLists[sizeClass];
+            if (block != nullptr) {
+                p.freeLists[sizeClass] = block->next;
+                p.stats.reusedAllocations++;
+                p.cached[sizeClass] -= classSize(sizeClass);
+                p.stats.cachedBytes -= classSize(sizeClass);
+                return block + 1;
+            }
+            p.stats.heapAllocations++;
+        }
+
+        size_t size = sizeClass < kNumClasses ? classSize(sizeClass) : bytes;
+        Header* block = static_cast<Header*>(::operator new(sizeof(Header) + size));
+        block->next = nullptr;
+        block->sizeClass = sizeClass;
+        return block + 1;
+    }
+
+    void release(void* memory) {
+        if (memory == nullptr) return;
+
+        Header* block = headerOf(memory);
+        if (block->sizeClass == kNumClasses) {
+            ::operator delete(block);
+            return;
+        }
+
+        Pool& p = pool();
+        {
+            lock_guard<mutex> guard(p.lock);
+            int sizeClass = block->sizeClass;
+            size_t size = classSize(sizeClass);
+            if (p.cached[sizeClass] + size <= kMaxCachedPerClass &&
+                p.stats.cachedBytes + size <= kMaxCachedBytes) {
+                block->next = p.freeLists[sizeClass];
+                p.freeLists[sizeClass] = block;
+                p.cached[sizeClass] += size;
+                p.stats.cachedBytes += size;
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+
+    void trim() {
+        Pool& p = pool();
+        lock_guard<mutex> guard(p.lock);
+        for (int sizeClass = 0; sizeClass < kNumClasses; sizeClass++) {
+            Header*& list = p.freeLists[sizeClass];
+            while (list != nullptr) {
+                Header* next = list->next;
+                ::operator delete(list);
+                list = next;
+            }
+            p.cached[sizeClass] = 0;
+        }
+        p.stats.cachedBytes = 0;
+    }
+
+    Stats stats() {
+        Pool& p = pool();
+        lock_guard<mutex> guard(p.lock);
+        return p.stats;
+    }
+}
+
+/* Arrays of Samples are waveforms, so they go through the pool. Single
+ * Samples are rare enough to leave to the heap.
+ */
+namespace MemoryDiagnostics {
+    void* Allocator<Sample>::scalarAlloc(size_t bytes) {
+        return ::operator new(bytes);
+    }
+
+    void* Allocator<Sample>::vectorAlloc(size_t bytes) {
+        return WaveformPool::allocate(bytes);
+    }
+
+    void Allocator<Sample>::scalarFree(void* memory) {
+        ::operator delete(memory);
+    }
+
+    void Allocator<Sample>::vectorFree(void* memory) {
+        WaveformPool::release(memory);
+    }
+}
+
+
+/* * * * * Test Cases Below This Point * * * * */
+#include "GUI/SimpleTest.h"
+#include "StringInstrument.h"
+#include "StringBank.h"
+#include "Demos/AudioSystem.h"
+
+STUDENT_TEST("WaveformPool rounds sizes up to a class and reuses freed blocks.") {
+    EXPECT_EQUAL(classSize(0), 64);
+    EXPECT_EQUAL(classSize(1), 80);
+    EXPECT_EQUAL(classSize(4), 128);
+    EXPECT_EQUAL(classSize(7), 224);
+    EXPECT_EQUAL(classFor(1), 0);
+    EXPECT_EQUAL(classFor(64), 0);
+    EXPECT_EQUAL(classFor(65), 1);
+    EXPECT_EQUAL(classFor(129), 5);
+
+    /* Blocks are aligned for anything. */
+    void* first = WaveformPool::allocate(1000);
+    EXPECT_EQUAL(reinterpret_cast<uintptr_t>(first) % alignof(max_align_t), 0);
+
+    /* A freed block comes back for any request in the same class. */
+    WaveformPool::release(first);
+    WaveformPool::Stats before = WaveformPool::stats();
+    void* second = WaveformPool::allocate(990);
+    EXPECT_EQUAL(second, first);
+    EXPECT_EQUAL(WaveformPool::stats().heapAllocations, before.heapAllocations);
+    EXPECT_EQUAL(WaveformPool::stats().reusedAllocations, before.reusedAllocations + 1);
+    WaveformPool::release(second);
+
+    /* Trimming gives everything back to the heap. */
+    WaveformPool::trim();
+    EXPECT_EQUAL(WaveformPool::stats().cachedBytes, 0);
+
+    /* Huge blocks skip the free lists entirely. */
+    void* huge = WaveformPool::allocate(classSize(kNumClasses - 1) + 1);
+    EXPECT_NOT_EQUAL(huge, nullptr);
+    WaveformPool::release(huge);
+    EXPECT_EQUAL(WaveformPool::stats().cachedBytes, 0);
+
+    /* So do blocks past the per-class limit... */
+    void* big = WaveformPool::allocate(kMaxCachedPerClass + 1);
+    WaveformPool::release(big);
+    EXPECT_EQUAL(WaveformPool::stats().cachedBytes, 0);
+
+    /* ...and blocks that would take a class over it. */
+    int sizeClass = classFor(kMaxCachedPerClass / 3);
+    vector<void*> blocks;
+    for (int i = 0; i < 5; i++) {
+        blocks.push_back(WaveformPool::allocate(classSize(sizeClass)));
+    }
+    for (void* block: blocks) {
+        WaveformPool::release(block);
+    }
+    size_t perClass = kMaxCachedPerClass / classSize(sizeClass) * classSize(sizeClass);
+    EXPECT_EQUAL(WaveformPool::stats().cachedBytes, perClass);
+    WaveformPool::trim();
+}
+
+STUDENT_TEST("Copying and rebuilding strings reuses waveform memory.") {
+    AudioSystem::setSampleRate(44100);
+
+    /* Warm the pool up with a full set of strings. */
+    {
+        StringInstrument* strings = new StringInstrument[16];
+        for (int i = 0; i < 16; i++) {
+            strings[i] = StringInstrument(110 * (i + 1));
+        }
+        StringInstrument copy = strings[3];
+        delete[] strings;
+    }
+
+    /* Doing it all again shouldn't need the heap at all. */
+    WaveformPool::Stats before = WaveformPool::stats();
+    {
+        StringInstrument* strings = new StringInstrument[16];
+        for (int i = 0; i < 16; i++) {
+            strings[i] = StringInstrument(110 * (i + 1));
+        }
+        StringInstrument copy = strings[3];
+        delete[] strings;
+    }
+    WaveformPool::Stats after = WaveformPool::stats();
+    EXPECT_EQUAL(after.heapAllocations, before.heapAllocations);
+    EXPECT(after.reusedAllocations > before.reusedAllocations);
+
+    /* Same for string banks whose arenas have to grow, in either precision. */
+    for (int pass = 0; pass < 2; pass++) {
+        before = WaveformPool::stats();
+        StringBank bank;
+        FloatStringBank floatBank;
+        for (int i = 0; i < 40; i++) {
+            bank.add(110 + 10 * i);
+            floatBank.add(110 + 10 * i);
+        }
+        if (pass == 1) {
+            EXPECT_EQUAL(WaveformPool::stats().heapAllocations, before.heapAllocations);
+        }
+    }
+}
@@ -0,0 +1,46 @@
+/* File: WaveformPool.h
+ *
+ * A size-class pool for arrays of Samples. Waveforms come and go in a handful
+ * of sizes (one per note), so rather than handing freed waveforms back to the
+ * heap, the pool keeps them on a free list for their size class and gives
+ * them out again the next time something of about that size is needed.
+ * Constructing, copying, and destroying StringInstruments, and regrowing a
+ * StringBank's arena, then stop going to the heap once the pool is warm.
+ *
+ * Sample hooks into this through MemoryDiagnostics::Allocator, so every
+ * new Sample[] and delete[] on Samples goes through the pool automatically.
+ * FloatStringBank's arenas go through it by hand. The pool is safe to use
+ * from several threads, but takes a lock, so it still shouldn't be used from
+ * the audio thread.
+ *
+ * The free lists are capped, so memory from a one-off burst of big waveforms
+ * goes back to the heap rather than staying cached forever.
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace WaveformPool {
+    /* Returns a block of at least the given number of bytes, aligned for any
+     * type. Blocks too big for any size class come straight from the heap.
+     */
+    void* allocate(std::size_t bytes);
+
+    /* Hands a block from allocate() back to the pool, which keeps it for
+     * next time unless that would take its free lists over their limit.
+     */
+    void release(void* memory);
+
+    /* Returns every block sitting on a free list to the heap. */
+    void trim();
+
+    struct Stats {
+        int64_t heapAllocations;    // Blocks the pool has had to get from the heap
+        int64_t reusedAllocations;  // Blocks handed out again from a free list
+        std::size_t cachedBytes;    // Bytes sitting on free lists right now
+    };
+
+    /* Counts of what the pool has done so far. */
+    Stats stats();
+}